@@ -5,13 +5,19 @@
 #include <string.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
 #include <time.h>
+#include <stdatomic.h>
 
 /* Define the Vector structure */
 typedef struct Vector {
     char *name;
     int size;
     int *vector;
+    uint64_t *bits; // 1 bit per dimension when packed (bipolar: set bit is -1)
+    bool packed;
+    bool borrowed; // elements are owned by a dense Space, not by the Vector
     char *vtype; // "binary" or "bipolar"
     char **tags;
     int tags_count;
@@ -19,23 +25,154 @@ typedef struct Vector {
     bool warning;
 } Vector;
 
+/* Number of 64-bit words holding a packed vector of the given size */
+#define PACKED_WORDS(size) (((size) + 63) / 64)
+
+/* Read-only view of a vector rotated by an offset: element i of the view is element
+ * (i - offset) mod size of the base, as after permute_vector(base, offset) */
+typedef struct VectorView {
+    Vector *base;
+    int offset; // in [0, size)
+} VectorView;
+
+/* Define the random number generator state */
+typedef struct Rng {
+    uint64_t state[4];
+} Rng;
+
+/* Define the BundleAccumulator structure */
+typedef struct BundleAccumulator {
+    int size;
+    char *vtype; // "binary" or "bipolar"
+    int32_t *counts32; // counters while they cannot overflow 32 bits, NULL once widened
+    int64_t *counts64; // widened counters, NULL until needed
+    int64_t bound; // upper bound on the magnitude of any counter
+    int count; // sum of the weights of the added vectors
+} BundleAccumulator;
+
 /* Function prototypes */
+uint64_t hash_string(const char *str);
+uint64_t rng_entropy_seed(void);
+void rng_init(Rng *rng, uint64_t seed, uint64_t stream);
+uint64_t rng_next(Rng *rng);
+uint64_t rng_bounded(Rng *rng, uint64_t bound);
 Vector *create_vector(const char *name, int size, const char *vtype, int seed, bool warning);
+Vector *create_packed_vector(const char *name, int size, const char *vtype, int seed, bool warning);
 void free_vector(Vector *vec);
 void print_vector(Vector *vec);
+Vector *alloc_vector(const char *name, int size, const char *vtype, bool packed);
 Vector *bind_vectors(Vector *vec1, Vector *vec2);
 Vector *bundle_vectors(Vector *vec1, Vector *vec2);
 Vector *subtract_vectors(Vector *vec1, Vector *vec2);
 Vector *permute_vector(Vector *vec, int rotate_by);
+void bind_vectors_into(Vector *dst, Vector *vec1, Vector *vec2);
+void bundle_vectors_into(Vector *dst, Vector *vec1, Vector *vec2);
+void subtract_vectors_into(Vector *dst, Vector *vec1, Vector *vec2);
+void permute_vector_into(Vector *dst, Vector *vec, int rotate_by);
+VectorView vector_view(Vector *vec, int rotate_by);
+void bind_view_into(Vector *dst, Vector *vec, VectorView view);
+void bind_vectors_inplace(Vector *vec1, Vector *vec2);
+void bundle_vectors_inplace(Vector *vec1, Vector *vec2);
+void subtract_vectors_inplace(Vector *vec1, Vector *vec2);
+void bundle_accumulator_init(BundleAccumulator *acc, int size, const char *vtype);
+void bundle_accumulator_free(BundleAccumulator *acc);
+void bundle_accumulator_reset(BundleAccumulator *acc);
+void bundle_accumulator_add(BundleAccumulator *acc, Vector *vec);
+void bundle_accumulator_add_weighted(BundleAccumulator *acc, Vector *vec, int weight);
+void bundle_accumulator_add_view(BundleAccumulator *acc, VectorView view, int weight, int magnitude);
+void bundle_accumulator_subtract(BundleAccumulator *acc, Vector *vec);
+void bundle_accumulator_merge(BundleAccumulator *acc, const BundleAccumulator *src);
+void bundle_accumulator_counts(BundleAccumulator *acc, Vector *dst);
+void bundle_accumulator_threshold(BundleAccumulator *acc, Vector *dst, double threshold, int seed);
+void bundle_accumulator_finalize(BundleAccumulator *acc, Vector *dst, int seed);
 
 /* Function implementations */
 
+/* Random number generation
+ * xoshiro256** streams seeded through splitmix64. A stream is keyed by a seed and a
+ * stream id (usually the hash of a vector name), so the same (seed, name) pair always
+ * gives the same vector, on any thread and in any creation order. */
+
+/* Advance a splitmix64 state and return its next output */
+static inline uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += UINT64_C(0x9E3779B97F4A7C15));
+    z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+    return z ^ (z >> 31);
+}
+
+/* Hash a string with 64-bit FNV-1a */
+uint64_t hash_string(const char *str) {
+    uint64_t hash = UINT64_C(0xCBF29CE484222325);
+    for (const unsigned char *c = (const unsigned char *)str; *c; c++) {
+        hash = (hash ^ *c) * UINT64_C(0x100000001B3);
+    }
+    return hash;
+}
+
+/* Draw a fresh seed for callers asking for a non-reproducible stream (seed -1) */
+uint64_t rng_entropy_seed(void) {
+    static _Atomic uint64_t counter = 0;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t state = ((uint64_t)now.tv_sec << 32) ^ (uint64_t)now.tv_nsec ^ (uint64_t)(uintptr_t)&now;
+    state ^= splitmix64(&(uint64_t){ counter++ });
+    return splitmix64(&state);
+}
+
+/* Initialize the stream identified by (seed, stream) */
+void rng_init(Rng *rng, uint64_t seed, uint64_t stream) {
+    uint64_t key = seed;
+    key = splitmix64(&key) ^ stream;
+    for (int i = 0; i < 4; i++) {
+        rng->state[i] = splitmix64(&key);
+    }
+}
+
+/* Next 64 random bits */
+uint64_t rng_next(Rng *rng) {
+    uint64_t *s = rng->state;
+    uint64_t result = s[1] * 5;
+    result = ((result << 7) | (result >> 57)) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 45) | (s[3] >> 19);
+    return result;
+}
+
+/* Uniform integer in [0, bound) without modulo bias */
+uint64_t rng_bounded(Rng *rng, uint64_t bound) {
+    __uint128_t product = (__uint128_t)rng_next(rng) * bound;
+    uint64_t low = (uint64_t)product;
+    if (low < bound) {
+        uint64_t threshold = -bound % bound;
+        while (low < threshold) {
+            product = (__uint128_t)rng_next(rng) * bound;
+            low = (uint64_t)product;
+        }
+    }
+    return (uint64_t)(product >> 64);
+}
+
+/* Initialize the stream of a named vector, drawing a fresh seed when seed is -1 */
+static void rng_init_vector(Rng *rng, const char *name, int seed) {
+    rng_init(rng, seed != -1 ? (uint64_t)seed : rng_entropy_seed(), hash_string(name));
+}
+
 /* Create a new Vector */
 Vector *create_vector(const char *name, int size, const char *vtype, int seed, bool warning) {
     if (size < 10000) {
         fprintf(stderr, "Vector size must be greater than or equal to 10000\n");
         exit(EXIT_FAILURE);
     }
+    if (strcmp(vtype, "binary") != 0 && strcmp(vtype, "bipolar") != 0) {
+        fprintf(stderr, "Vector type can be binary or bipolar only\n");
+        exit(EXIT_FAILURE);
+    }
 
     Vector *vec = (Vector *)malloc(sizeof(Vector));
     if (!vec) {
@@ -50,6 +187,9 @@ Vector *create_vector(const char *name, int size, const char *vtype, int seed, b
     vec->warning = warning;
     vec->tags = NULL;
     vec->tags_count = 0;
+    vec->borrowed = false;
+    vec->bits = NULL;
+    vec->packed = false;
 
     /* Initialize the vector */
     vec->vector = (int *)malloc(size * sizeof(int));
@@ -59,36 +199,177 @@ Vector *create_vector(const char *name, int size, const char *vtype, int seed, b
         exit(EXIT_FAILURE);
     }
 
-    /* Seed the random number generator */
-    if (seed != -1) {
-        srand(seed);
+    /* Generate random vector, 64 elements per draw
+     * Elements follow the packed bit encoding, so create_packed_vector draws the same vector */
+    Rng rng;
+    rng_init_vector(&rng, name, seed);
+    bool binary = strcmp(vtype, "binary") == 0;
+    for (int i = 0; i < size; i += 64) {
+        uint64_t bits = rng_next(&rng);
+        int count = size - i < 64 ? size - i : 64;
+        for (int j = 0; j < count; j++) {
+            int bit = (int)((bits >> j) & 1);
+            vec->vector[i + j] = binary ? bit : 1 - 2 * bit;
+        }
+    }
+
+    return vec;
+}
+
+/* Allocate a zero-filled Vector without drawing random elements */
+Vector *alloc_vector(const char *name, int size, const char *vtype, bool packed) {
+    if (size < 10000) {
+        fprintf(stderr, "Vector size must be greater than or equal to 10000\n");
+        exit(EXIT_FAILURE);
+    }
+    if (strcmp(vtype, "binary") != 0 && strcmp(vtype, "bipolar") != 0) {
+        fprintf(stderr, "Vector type can be binary or bipolar only\n");
+        exit(EXIT_FAILURE);
+    }
+
+    Vector *vec = (Vector *)malloc(sizeof(Vector));
+    if (!vec) {
+        perror("Failed to allocate memory for Vector");
+        exit(EXIT_FAILURE);
+    }
+
+    vec->name = strdup(name);
+    vec->size = size;
+    vec->vtype = strdup(vtype);
+    vec->seed = -1;
+    vec->warning = false;
+    vec->tags = NULL;
+    vec->tags_count = 0;
+    vec->borrowed = false;
+    vec->packed = packed;
+    vec->vector = NULL;
+    vec->bits = NULL;
+    if (packed) {
+        vec->bits = (uint64_t *)calloc(PACKED_WORDS(size), sizeof(uint64_t));
     } else {
-        srand(time(NULL));
+        vec->vector = (int *)calloc(size, sizeof(int));
+    }
+    if (!vec->vector && !vec->bits) {
+        perror("Failed to allocate memory for vector elements");
+        free(vec->name);
+        free(vec->vtype);
+        free(vec);
+        exit(EXIT_FAILURE);
     }
 
-    /* Generate random vector */
-    for (int i = 0; i < size; i++) {
-        int rand_value = rand() % 2;
-        if (strcmp(vtype, "binary") == 0) {
-            vec->vector[i] = rand_value;
-        } else if (strcmp(vtype, "bipolar") == 0) {
-            vec->vector[i] = rand_value == 0 ? -1 : 1;
-        } else {
-            fprintf(stderr, "Vector type can be binary or bipolar only\n");
-            free_vector(vec);
-            exit(EXIT_FAILURE);
-        }
+    return vec;
+}
+
+/* Create a new random Vector stored with 1 bit per dimension */
+Vector *create_packed_vector(const char *name, int size, const char *vtype, int seed, bool warning) {
+    if (size < 10000) {
+        fprintf(stderr, "Vector size must be greater than or equal to 10000\n");
+        exit(EXIT_FAILURE);
+    }
+    if (strcmp(vtype, "binary") != 0 && strcmp(vtype, "bipolar") != 0) {
+        fprintf(stderr, "Vector type can be binary or bipolar only\n");
+        exit(EXIT_FAILURE);
+    }
+
+    Vector *vec = (Vector *)malloc(sizeof(Vector));
+    if (!vec) {
+        perror("Failed to allocate memory for Vector");
+        exit(EXIT_FAILURE);
+    }
+
+    vec->name = strdup(name);
+    vec->size = size;
+    vec->vtype = strdup(vtype);
+    vec->seed = seed;
+    vec->warning = warning;
+    vec->tags = NULL;
+    vec->tags_count = 0;
+    vec->borrowed = false;
+    vec->vector = NULL;
+    vec->packed = true;
+
+    /* Trailing bits of the last word are always kept to zero */
+    vec->bits = (uint64_t *)calloc(PACKED_WORDS(size), sizeof(uint64_t));
+    if (!vec->bits) {
+        perror("Failed to allocate memory for vector elements");
+        free(vec);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Generate random bits, one word per draw */
+    Rng rng;
+    rng_init_vector(&rng, name, seed);
+    int words = PACKED_WORDS(size);
+    for (int i = 0; i < words; i++) {
+        vec->bits[i] = rng_next(&rng);
+    }
+    if (size % 64 != 0) {
+        vec->bits[words - 1] &= (UINT64_C(1) << (size % 64)) - 1;
     }
 
     return vec;
 }
 
+/* Get the i-th element of a Vector regardless of its storage */
+static inline int vector_element(const Vector *vec, int i) {
+    if (!vec->packed) {
+        return vec->vector[i];
+    }
+    int bit = (int)((vec->bits[i / 64] >> (i % 64)) & 1);
+    if (strcmp(vec->vtype, "binary") == 0) {
+        return bit;
+    }
+    return bit ? -1 : 1;
+}
+
+/* Read count (<= 64) consecutive bits starting at a bit position of a packed buffer */
+static inline uint64_t packed_read_bits(const uint64_t *bits, int start, int count) {
+    if (count == 0) {
+        return 0;
+    }
+    int word = start / 64;
+    int offset = start % 64;
+    uint64_t value = bits[word] >> offset;
+    if (offset != 0 && offset + count > 64) {
+        value |= bits[word + 1] << (64 - offset);
+    }
+    if (count < 64) {
+        value &= (UINT64_C(1) << count) - 1;
+    }
+    return value;
+}
+
+/* Word w of a packed buffer rotated by shift (in [0, size)) */
+static inline uint64_t packed_rotated_word(const uint64_t *src, int size, int shift, int w) {
+    int count = size - w * 64 < 64 ? size - w * 64 : 64;
+    int start = w * 64 - shift;
+    if (start < 0) {
+        start += size;
+    }
+    int head = size - start;
+    if (head >= count) {
+        return packed_read_bits(src, start, count);
+    }
+    return packed_read_bits(src, start, head) | (packed_read_bits(src, 0, count - head) << head);
+}
+
+/* Rotate a packed buffer so that bit i of src lands on bit (i + rotate_by) mod size of dst */
+static void packed_rotate(uint64_t *dst, const uint64_t *src, int size, int rotate_by) {
+    int shift = ((rotate_by % size) + size) % size;
+    for (int w = 0; w < PACKED_WORDS(size); w++) {
+        dst[w] = packed_rotated_word(src, size, shift, w);
+    }
+}
+
 /* Free a Vector */
 void free_vector(Vector *vec) {
     if (vec) {
         free(vec->name);
         free(vec->vtype);
-        free(vec->vector);
+        if (!vec->borrowed) {
+            free(vec->vector);
+            free(vec->bits);
+        }
         if (vec->tags) {
             for (int i = 0; i < vec->tags_count; i++) {
                 free(vec->tags[i]);
@@ -110,7 +391,7 @@ void print_vector(Vector *vec) {
     }
     printf("\nVector Elements: [");
     for (int i = 0; i < vec->size; i++) {
-        printf("%d ", vec->vector[i]);
+        printf("%d ", vector_element(vec, i));
         if ((i + 1) % 10 == 0 && i != vec->size - 1) {
             printf("\n");
         }
@@ -118,8 +399,8 @@ void print_vector(Vector *vec) {
     printf("]\n");
 }
 
-/* Bind two vectors */
-Vector *bind_vectors(Vector *vec1, Vector *vec2) {
+/* Check that two vectors can be combined element-wise */
+static void check_compatible(Vector *vec1, Vector *vec2) {
     if (vec1->size != vec2->size) {
         fprintf(stderr, "Vectors must have the same size\n");
         exit(EXIT_FAILURE);
@@ -128,33 +409,192 @@ Vector *bind_vectors(Vector *vec1, Vector *vec2) {
         fprintf(stderr, "Vector types are not compatible\n");
         exit(EXIT_FAILURE);
     }
+}
 
-    Vector *result = create_vector("BindResult", vec1->size, vec1->vtype, -1, false);
+/* Bind two vectors into dst, which may alias either operand */
+void bind_vectors_into(Vector *dst, Vector *vec1, Vector *vec2) {
+    check_compatible(vec1, vec2);
+    check_compatible(dst, vec1);
+
+    if (vec1->packed && vec2->packed) {
+        if (!dst->packed) {
+            fprintf(stderr, "Binding packed vectors requires a packed destination\n");
+            exit(EXIT_FAILURE);
+        }
+        /* XOR matches multiplication under the bipolar encoding and is the binary bind */
+        for (int i = 0; i < PACKED_WORDS(vec1->size); i++) {
+            dst->bits[i] = vec1->bits[i] ^ vec2->bits[i];
+        }
+        return;
+    }
+    if (dst->packed) {
+        fprintf(stderr, "Packed destination requires packed operands\n");
+        exit(EXIT_FAILURE);
+    }
+    /* Binary elements are bound with XOR as well, so packing never changes the result */
+    if (strcmp(vec1->vtype, "binary") == 0) {
+        for (int i = 0; i < vec1->size; i++) {
+            dst->vector[i] = vector_element(vec1, i) ^ vector_element(vec2, i);
+        }
+        return;
+    }
+    if (!vec1->packed && !vec2->packed) {
+        for (int i = 0; i < vec1->size; i++) {
+            dst->vector[i] = vec1->vector[i] * vec2->vector[i];
+        }
+        return;
+    }
     for (int i = 0; i < vec1->size; i++) {
-        result->vector[i] = vec1->vector[i] * vec2->vector[i];
+        dst->vector[i] = vector_element(vec1, i) * vector_element(vec2, i);
     }
+}
 
-    /* Merge tags */
-    // Assuming tags are merged; implement tag handling as needed.
+/* Bundle two vectors into dst, which may alias either operand */
+void bundle_vectors_into(Vector *dst, Vector *vec1, Vector *vec2) {
+    check_compatible(vec1, vec2);
+    check_compatible(dst, vec1);
+    if (dst->packed) {
+        fprintf(stderr, "Bundled counts cannot be stored in a packed vector\n");
+        exit(EXIT_FAILURE);
+    }
 
-    return result;
+    if (!vec1->packed && !vec2->packed) {
+        for (int i = 0; i < vec1->size; i++) {
+            dst->vector[i] = vec1->vector[i] + vec2->vector[i];
+        }
+        return;
+    }
+    for (int i = 0; i < vec1->size; i++) {
+        dst->vector[i] = vector_element(vec1, i) + vector_element(vec2, i);
+    }
 }
 
-/* Bundle two vectors */
-Vector *bundle_vectors(Vector *vec1, Vector *vec2) {
-    if (vec1->size != vec2->size) {
-        fprintf(stderr, "Vectors must have the same size\n");
+/* Subtract vec2 from vec1 into dst, which may alias either operand */
+void subtract_vectors_into(Vector *dst, Vector *vec1, Vector *vec2) {
+    check_compatible(vec1, vec2);
+    check_compatible(dst, vec1);
+    if (dst->packed) {
+        fprintf(stderr, "Subtracted counts cannot be stored in a packed vector\n");
         exit(EXIT_FAILURE);
     }
-    if (strcmp(vec1->vtype, vec2->vtype) != 0) {
-        fprintf(stderr, "Vector types are not compatible\n");
+
+    if (!vec1->packed && !vec2->packed) {
+        for (int i = 0; i < vec1->size; i++) {
+            dst->vector[i] = vec1->vector[i] - vec2->vector[i];
+        }
+        return;
+    }
+    for (int i = 0; i < vec1->size; i++) {
+        dst->vector[i] = vector_element(vec1, i) - vector_element(vec2, i);
+    }
+}
+
+/* Permute a vector into dst, which must not alias it */
+void permute_vector_into(Vector *dst, Vector *vec, int rotate_by) {
+    check_compatible(dst, vec);
+    if (dst == vec) {
+        fprintf(stderr, "Permutation destination must differ from its source\n");
+        exit(EXIT_FAILURE);
+    }
+    if (dst->packed != vec->packed) {
+        fprintf(stderr, "Vectors must be both packed or both unpacked\n");
         exit(EXIT_FAILURE);
     }
 
-    Vector *result = create_vector("BundleResult", vec1->size, vec1->vtype, -1, false);
-    for (int i = 0; i < vec1->size; i++) {
-        result->vector[i] = vec1->vector[i] + vec2->vector[i];
+    if (vec->packed) {
+        packed_rotate(dst->bits, vec->bits, vec->size, rotate_by);
+        return;
     }
+    int shift = ((rotate_by % vec->size) + vec->size) % vec->size;
+    memcpy(dst->vector + shift, vec->vector, (vec->size - shift) * sizeof(int));
+    memcpy(dst->vector, vec->vector + vec->size - shift, shift * sizeof(int));
+}
+
+/* View a vector rotated by rotate_by without copying it */
+VectorView vector_view(Vector *vec, int rotate_by) {
+    VectorView view;
+    view.base = vec;
+    view.offset = ((rotate_by % vec->size) + vec->size) % vec->size;
+    return view;
+}
+
+/* Bind a vector with a rotated view into dst, which may alias vec but not the view */
+void bind_view_into(Vector *dst, Vector *vec, VectorView view) {
+    Vector *base = view.base;
+    check_compatible(vec, base);
+    check_compatible(dst, vec);
+    if (dst == base) {
+        fprintf(stderr, "Binding destination must differ from the viewed vector\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (vec->packed && base->packed) {
+        if (!dst->packed) {
+            fprintf(stderr, "Binding packed vectors requires a packed destination\n");
+            exit(EXIT_FAILURE);
+        }
+        for (int w = 0; w < PACKED_WORDS(vec->size); w++) {
+            dst->bits[w] = vec->bits[w] ^ packed_rotated_word(base->bits, base->size, view.offset, w);
+        }
+        return;
+    }
+    if (dst->packed) {
+        fprintf(stderr, "Packed destination requires packed operands\n");
+        exit(EXIT_FAILURE);
+    }
+    /* The view is base[size - offset, size) followed by base[0, size - offset) */
+    int head = view.offset;
+    int tail = vec->size - head;
+    if (!vec->packed && !base->packed) {
+        const int *wrapped = base->vector + tail;
+        for (int i = 0; i < head; i++) {
+            dst->vector[i] = vec->vector[i] * wrapped[i];
+        }
+        for (int i = 0; i < tail; i++) {
+            dst->vector[head + i] = vec->vector[head + i] * base->vector[i];
+        }
+        return;
+    }
+    for (int i = 0; i < head; i++) {
+        dst->vector[i] = vector_element(vec, i) * vector_element(base, tail + i);
+    }
+    for (int i = 0; i < tail; i++) {
+        dst->vector[head + i] = vector_element(vec, head + i) * vector_element(base, i);
+    }
+}
+
+/* Bind vec2 into vec1 */
+void bind_vectors_inplace(Vector *vec1, Vector *vec2) {
+    bind_vectors_into(vec1, vec1, vec2);
+}
+
+/* Bundle vec2 into vec1 */
+void bundle_vectors_inplace(Vector *vec1, Vector *vec2) {
+    bundle_vectors_into(vec1, vec1, vec2);
+}
+
+/* Subtract vec2 from vec1 in place */
+void subtract_vectors_inplace(Vector *vec1, Vector *vec2) {
+    subtract_vectors_into(vec1, vec1, vec2);
+}
+
+/* Bind two vectors */
+Vector *bind_vectors(Vector *vec1, Vector *vec2) {
+    check_compatible(vec1, vec2);
+    Vector *result = alloc_vector("BindResult", vec1->size, vec1->vtype, vec1->packed && vec2->packed);
+    bind_vectors_into(result, vec1, vec2);
+
+    /* Merge tags */
+    // Assuming tags are merged; implement tag handling as needed.
+
+    return result;
+}
+
+/* Bundle two vectors */
+Vector *bundle_vectors(Vector *vec1, Vector *vec2) {
+    check_compatible(vec1, vec2);
+    Vector *result = alloc_vector("BundleResult", vec1->size, vec1->vtype, false);
+    bundle_vectors_into(result, vec1, vec2);
 
     /* Merge tags */
     // Assuming tags are merged; implement tag handling as needed.
@@ -164,39 +604,265 @@ Vector *bundle_vectors(Vector *vec1, Vector *vec2) {
 
 /* Subtract one vector from another */
 Vector *subtract_vectors(Vector *vec1, Vector *vec2) {
-    if (vec1->size != vec2->size) {
+    check_compatible(vec1, vec2);
+    Vector *result = alloc_vector("SubtractResult", vec1->size, vec1->vtype, false);
+    subtract_vectors_into(result, vec1, vec2);
+
+    /* Copy tags from vec1 */
+    // Implement tag copying as needed.
+
+    return result;
+}
+
+/* Permute a vector */
+Vector *permute_vector(Vector *vec, int rotate_by) {
+    Vector *result = alloc_vector("PermuteResult", vec->size, vec->vtype, vec->packed);
+    permute_vector_into(result, vec, rotate_by);
+
+    /* Copy tags */
+    // Implement tag copying as needed.
+
+    return result;
+}
+
+/* Bundle accumulators
+ * Vectors are summed into one counter per dimension. Counters start as 32-bit and
+ * are widened to 64-bit as soon as one of them could overflow: a bound on their
+ * magnitude grows with every addition and is tightened to the largest counter when it
+ * passes the 32-bit range, so any number of additions stays exact. */
+
+/* Initialize an empty accumulator */
+void bundle_accumulator_init(BundleAccumulator *acc, int size, const char *vtype) {
+    if (strcmp(vtype, "binary") != 0 && strcmp(vtype, "bipolar") != 0) {
+        fprintf(stderr, "Vector type can be binary or bipolar only\n");
+        exit(EXIT_FAILURE);
+    }
+    acc->size = size;
+    acc->vtype = strdup(vtype);
+    acc->counts32 = (int32_t *)calloc(size, sizeof(int32_t));
+    acc->counts64 = NULL;
+    acc->bound = 0;
+    acc->count = 0;
+    if (!acc->counts32) {
+        perror("Failed to allocate memory for bundle accumulator");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Free the counters of an accumulator */
+void bundle_accumulator_free(BundleAccumulator *acc) {
+    free(acc->vtype);
+    free(acc->counts32);
+    free(acc->counts64);
+    acc->vtype = NULL;
+    acc->counts32 = NULL;
+    acc->counts64 = NULL;
+}
+
+/* Empty an accumulator, keeping its counters */
+void bundle_accumulator_reset(BundleAccumulator *acc) {
+    if (acc->counts64) {
+        memset(acc->counts64, 0, acc->size * sizeof(int64_t));
+    } else {
+        memset(acc->counts32, 0, acc->size * sizeof(int32_t));
+    }
+    acc->bound = 0;
+    acc->count = 0;
+}
+
+/* Make room for counts growing by up to magnitude, widening the counters if needed */
+static void bundle_accumulator_reserve(BundleAccumulator *acc, int64_t magnitude) {
+    acc->bound += magnitude;
+    if (acc->counts64 || acc->bound <= INT32_MAX) {
+        return;
+    }
+    /* The bound also grows with subtractions: tighten it before widening */
+    int64_t largest = 0;
+    for (int i = 0; i < acc->size; i++) {
+        int64_t count = acc->counts32[i] < 0 ? -(int64_t)acc->counts32[i] : acc->counts32[i];
+        largest = count > largest ? count : largest;
+    }
+    acc->bound = largest + magnitude;
+    if (acc->bound <= INT32_MAX) {
+        return;
+    }
+    acc->counts64 = (int64_t *)malloc(acc->size * sizeof(int64_t));
+    if (!acc->counts64) {
+        perror("Failed to allocate memory for bundle accumulator");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < acc->size; i++) {
+        acc->counts64[i] = acc->counts32[i];
+    }
+    free(acc->counts32);
+    acc->counts32 = NULL;
+}
+
+/* Add weight times count elements of vec starting at from to the counters starting at to */
+static void bundle_accumulator_add_segment(BundleAccumulator *acc, Vector *vec, int from, int to, int count, int weight) {
+    if (acc->counts64) {
+        int64_t *counts = acc->counts64 + to;
+        for (int i = 0; i < count; i++) {
+            counts[i] += (int64_t)weight * vector_element(vec, from + i);
+        }
+    } else if (!vec->packed) {
+        int32_t *counts = acc->counts32 + to;
+        const int *elements = vec->vector + from;
+        for (int i = 0; i < count; i++) {
+            counts[i] += weight * elements[i];
+        }
+    } else {
+        int32_t *counts = acc->counts32 + to;
+        for (int i = 0; i < count; i++) {
+            counts[i] += weight * vector_element(vec, from + i);
+        }
+    }
+}
+
+/* Add a rotated view multiplied by an integer weight, without materializing the rotation.
+ * magnitude bounds the absolute value of the elements of the base vector: 1 for the
+ * vectors of a space, the number of added vectors for a vector of bundle counts */
+void bundle_accumulator_add_view(BundleAccumulator *acc, VectorView view, int weight, int magnitude) {
+    Vector *vec = view.base;
+    if (acc->size != vec->size) {
         fprintf(stderr, "Vectors must have the same size\n");
         exit(EXIT_FAILURE);
     }
-    if (strcmp(vec1->vtype, vec2->vtype) != 0) {
+    if (strcmp(acc->vtype, vec->vtype) != 0) {
         fprintf(stderr, "Vector types are not compatible\n");
         exit(EXIT_FAILURE);
     }
 
-    Vector *result = create_vector("SubtractResult", vec1->size, vec1->vtype, -1, false);
-    for (int i = 0; i < vec1->size; i++) {
-        result->vector[i] = vec1->vector[i] - vec2->vector[i];
+    bundle_accumulator_reserve(acc, (int64_t)magnitude * llabs((int64_t)weight));
+    acc->count += weight;
+
+    /* Counter i receives element (i - offset) mod size, in two contiguous segments */
+    int tail = vec->size - view.offset;
+    bundle_accumulator_add_segment(acc, vec, tail, 0, view.offset, weight);
+    bundle_accumulator_add_segment(acc, vec, 0, view.offset, tail, weight);
+}
+
+/* Add a vector multiplied by an integer weight; the largest magnitude of its elements is
+ * looked up, use bundle_accumulator_add_view when it is known */
+void bundle_accumulator_add_weighted(BundleAccumulator *acc, Vector *vec, int weight) {
+    int largest = 1;
+    if (!vec->packed) {
+        for (int i = 0; i < vec->size; i++) {
+            int magnitude = abs(vec->vector[i]);
+            largest = magnitude > largest ? magnitude : largest;
+        }
     }
+    bundle_accumulator_add_view(acc, vector_view(vec, 0), weight, largest);
+}
 
-    /* Copy tags from vec1 */
-    // Implement tag copying as needed.
+/* Add a vector */
+void bundle_accumulator_add(BundleAccumulator *acc, Vector *vec) {
+    bundle_accumulator_add_weighted(acc, vec, 1);
+}
 
-    return result;
+/* Remove a vector previously added */
+void bundle_accumulator_subtract(BundleAccumulator *acc, Vector *vec) {
+    bundle_accumulator_add_weighted(acc, vec, -1);
 }
 
-/* Permute a vector */
-Vector *permute_vector(Vector *vec, int rotate_by) {
-    Vector *result = create_vector("PermuteResult", vec->size, vec->vtype, -1, false);
+/* Get the counter of a dimension */
+static inline int64_t bundle_accumulator_at(const BundleAccumulator *acc, int i) {
+    return acc->counts64 ? acc->counts64[i] : acc->counts32[i];
+}
 
-    for (int i = 0; i < vec->size; i++) {
-        int new_index = (i + rotate_by) % vec->size;
-        result->vector[new_index] = vec->vector[i];
+/* Add the counters of another accumulator, as if its vectors had been added one by one */
+void bundle_accumulator_merge(BundleAccumulator *acc, const BundleAccumulator *src) {
+    if (acc->size != src->size || strcmp(acc->vtype, src->vtype) != 0) {
+        fprintf(stderr, "Bundle accumulators must have the same size and type\n");
+        exit(EXIT_FAILURE);
     }
+    bundle_accumulator_reserve(acc, src->bound);
+    acc->count += src->count;
+    if (acc->counts64) {
+        for (int i = 0; i < acc->size; i++) {
+            acc->counts64[i] += bundle_accumulator_at(src, i);
+        }
+    } else if (src->counts64) {
+        /* src stays widened after a reset or once counts has tightened its bound, but
+         * the bound still keeps its counters within 32 bits */
+        for (int i = 0; i < acc->size; i++) {
+            acc->counts32[i] += (int32_t)src->counts64[i];
+        }
+    } else {
+        for (int i = 0; i < acc->size; i++) {
+            acc->counts32[i] += src->counts32[i];
+        }
+    }
+}
 
-    /* Copy tags */
-    // Implement tag copying as needed.
+/* Copy the raw sums into an unpacked vector */
+void bundle_accumulator_counts(BundleAccumulator *acc, Vector *dst) {
+    if (dst->size != acc->size || dst->packed) {
+        fprintf(stderr, "Bundle counts require an unpacked vector of the same size\n");
+        exit(EXIT_FAILURE);
+    }
+    if (acc->bound > INT_MAX) {
+        /* The bound also grows with subtractions: tighten it to the largest counter */
+        int64_t largest = 0;
+        for (int i = 0; i < acc->size; i++) {
+            int64_t magnitude = llabs(bundle_accumulator_at(acc, i));
+            largest = magnitude > largest ? magnitude : largest;
+        }
+        acc->bound = largest;
+        if (largest > INT_MAX) {
+            fprintf(stderr, "Bundle counts do not fit in vector elements\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < acc->size; i++) {
+        dst->vector[i] = (int)bundle_accumulator_at(acc, i);
+    }
+}
 
-    return result;
+/* Write 1 where a count is above the threshold and 0 (binary) or -1 (bipolar) where it
+ * is below; ties are broken by a random stream of (seed, dst name) */
+void bundle_accumulator_threshold(BundleAccumulator *acc, Vector *dst, double threshold, int seed) {
+    if (dst->size != acc->size || strcmp(dst->vtype, acc->vtype) != 0) {
+        fprintf(stderr, "Vectors must have the same size and type\n");
+        exit(EXIT_FAILURE);
+    }
+    bool binary = strcmp(acc->vtype, "binary") == 0;
+    Rng rng;
+    rng_init_vector(&rng, dst->name, seed);
+    uint64_t ties = 0;
+    int ties_left = 0;
+    if (dst->packed) {
+        memset(dst->bits, 0, PACKED_WORDS(dst->size) * sizeof(uint64_t));
+    }
+    for (int i = 0; i < acc->size; i++) {
+        double value = (double)bundle_accumulator_at(acc, i);
+        bool high;
+        if (value != threshold) {
+            high = value > threshold;
+        } else {
+            if (ties_left == 0) {
+                ties = rng_next(&rng);
+                ties_left = 64;
+            }
+            high = ties & 1;
+            ties >>= 1;
+            ties_left--;
+        }
+        if (dst->packed) {
+            /* Set bits are 1 for binary and -1 for bipolar vectors */
+            if (high == binary) {
+                dst->bits[i / 64] |= UINT64_C(1) << (i % 64);
+            }
+        } else {
+            dst->vector[i] = high ? 1 : (binary ? 0 : -1);
+        }
+    }
+}
+
+/* Write the element-wise majority of the added vectors */
+void bundle_accumulator_finalize(BundleAccumulator *acc, Vector *dst, int seed) {
+    bool binary = strcmp(acc->vtype, "binary") == 0;
+    bundle_accumulator_threshold(acc, dst, binary ? acc->count / 2.0 : 0.0, seed);
 }
 
 /* Example usage */
@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <math.h>
 #include <time.h>
 
@@ -26,8 +27,7 @@ typedef struct Graph {
     int nodes_counter;
     int edges_counter;
     Space *space;
-    int seed;
-    // Random number generator seed
+    int seed; // Random number generator seed
     // You can add more fields as needed
 } Graph;
 
@@ -66,10 +66,9 @@ Graph *create_graph(int size, bool directed, bool weighted, int seed) {
     graph->edges_counter = 0;
     graph->seed = seed;
     graph->space = create_space(size, graph->vtype);
-    if (seed != -1) {
-        srand(seed);
-    } else {
-        srand(time(NULL));
+    // Node and weight vectors draw from per-name streams of this seed
+    if (seed == -1) {
+        graph->seed = (int)(rng_entropy_seed() & INT32_MAX);
     }
     return graph;
 }
@@ -83,28 +82,18 @@ void free_graph(Graph *graph) {
     }
 }
 
-/* Get a Vector from the Space by name */
-Vector *get_vector_from_space(Space *space, const char *name) {
-    for (int i = 0; i < space->vector_count; i++) {
-        if (strcmp(space->vectors[i]->name, name) == 0) {
-            return space->vectors[i];
-        }
-    }
-    return NULL;
-}
-
 /* Add an edge to the graph */
 void add_edge(Graph *graph, const char *node1_name, const char *node2_name, double weight) {
     // Check if nodes exist; if not, create them
     Vector *node1 = get_vector_from_space(graph->space, node1_name);
     if (!node1) {
-        node1 = create_vector(node1_name, graph->size, graph->vtype, -1, false);
+        node1 = create_vector(node1_name, graph->size, graph->vtype, graph->seed, false);
         insert_vector(graph->space, node1);
         graph->nodes_counter++;
     }
     Vector *node2 = get_vector_from_space(graph->space, node2_name);
     if (!node2) {
-        node2 = create_vector(node2_name, graph->size, graph->vtype, -1, false);
+        node2 = create_vector(node2_name, graph->size, graph->vtype, graph->seed, false);
         insert_vector(graph->space, node2);
         graph->nodes_counter++;
     }
@@ -139,7 +128,8 @@ void build_node_memory(Graph *graph, const char *node_name) {
         exit(EXIT_FAILURE);
     }
     // Initialize node memory
-    Vector *node_memory = create_vector("NodeMemory", graph->size, graph->vtype, -1, false);
+    Vector *node_memory = alloc_vector("NodeMemory", graph->size, graph->vtype, false);
+    Vector *weighted_neighbor = graph->weighted ? alloc_vector("WeightedNeighbor", graph->size, graph->vtype, false) : NULL;
     // Assuming node has a list of children and weights
     for (int i = 0; i < node->children_count; i++) {
         const char *neighbor_name = node->children[i];
@@ -156,15 +146,15 @@ void build_node_memory(Graph *graph, const char *node_name) {
                 fprintf(stderr, "Weight vector '%s' not found\n", weight_vector_name);
                 exit(EXIT_FAILURE);
             }
-            temp_vector = bind_vectors(weight_vector, neighbor);
+            bind_vectors_into(weighted_neighbor, weight_vector, neighbor);
+            temp_vector = weighted_neighbor;
         } else {
             temp_vector = neighbor;
         }
         // Bundle temp_vector into node_memory
-        for (int j = 0; j < graph->size; j++) {
-            node_memory->vector[j] += temp_vector->vector[j];
-        }
+        bundle_vectors_inplace(node_memory, temp_vector);
     }
+    free_vector(weighted_neighbor);
     // Store node_memory in the node (you may need to add a field to Vector)
     node->memory = node_memory;
 }
@@ -175,6 +165,8 @@ void build_weight_memory(Graph *graph, double start, double end, double step) {
     int change = graph->size / 2;
     int next_level = graph->size / (2 * levels);
 
+    Rng rng;
+    rng_init(&rng, (uint64_t)graph->seed, hash_string("__weight__"));
     int *base_vector = (int *)malloc(graph->size * sizeof(int));
     for (int i = 0; i < graph->size; i++) {
         base_vector[i] = -1; // Initialize to -1 for bipolar
@@ -182,10 +174,10 @@ void build_weight_memory(Graph *graph, double start, double end, double step) {
     for (double w = start; w < end; w += step) {
         char weight_vector_name[50];
         sprintf(weight_vector_name, "__weight__%.2f", w);
-        Vector *weight_vector = create_vector(weight_vector_name, graph->size, graph->vtype, -1, false);
+        Vector *weight_vector = alloc_vector(weight_vector_name, graph->size, graph->vtype, false);
         // Flip bits to create different weight vectors
         for (int i = 0; i < next_level; i++) {
-            int index = rand() % graph->size;
+            int index = (int)rng_bounded(&rng, graph->size);
             base_vector[index] *= -1;
         }
         memcpy(weight_vector->vector, base_vector, graph->size * sizeof(int));
@@ -225,18 +217,17 @@ void fit_graph(Graph *graph, Edge **edges, int edge_count) {
         }
     }
     // Build the graph vector
-    Vector *graph_vector = create_vector("__graph__", graph->size, graph->vtype, -1, false);
+    Vector *graph_vector = alloc_vector("__graph__", graph->size, graph->vtype, false);
+    Vector *temp_vector = alloc_vector("NodeEdges", graph->size, graph->vtype, false);
     for (int i = 0; i < graph->space->vector_count; i++) {
         Vector *node = graph->space->vectors[i];
         if (strcmp(node->name, "__graph__") != 0 && strncmp(node->name, "__weight__", 9) != 0) {
-            Vector *temp_vector = bind_vectors(node, node->memory);
+            bind_vectors_into(temp_vector, node, node->memory);
             // Bundle into graph_vector
-            for (int j = 0; j < graph->size; j++) {
-                graph_vector->vector[j] += temp_vector->vector[j];
-            }
-            free_vector(temp_vector);
+            bundle_vectors_inplace(graph_vector, temp_vector);
         }
     }
+    free_vector(temp_vector);
     // Normalize if undirected
     if (!graph->directed) {
         for (int i = 0; i < graph->size; i++) {
@@ -280,7 +271,7 @@ bool edge_exists(Graph *graph, const char *node1_name, const char *node2_name, d
         temp_vector = node2;
     }
     // Compute distance
-    *distance = vector_distance(node1_memory, temp_vector, "cosine");
+    *distance = vector_distance_by(node1_memory, temp_vector, DISTANCE_COSINE);
     free_vector(node1_memory);
     if (graph->weighted) {
         free_vector(temp_vector);
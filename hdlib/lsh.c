@@ -0,0 +1,293 @@
+/* Implementation of an approximate nearest-neighbour index over a Space in C */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+
+/* Assuming the Vector and Space structures and functions are defined as in previous implementations */
+/* Include the definitions of Vector and Space here or in a separate header file */
+
+/* Bit-sampling LSH
+ * Every table hashes a vector by a fixed random sample of its dimensions, one bit per
+ * dimension (the packed bit, or the sign of an unpacked element). Vectors close in
+ * Hamming distance agree on most samples, so they tend to share a bucket in at least
+ * one table. Candidates from all tables are then ranked with the exact distance.
+ * More tables or probes raise recall, more bits per key make buckets smaller and
+ * queries faster. */
+
+/* Define the LshTable structure */
+typedef struct LshTable {
+    uint32_t *keys; // key of each slot
+    int *heads; // first space position in each slot, -1 if empty
+    int capacity; // power of two
+    int used;
+    int *next; // next space position with the same key, per position
+} LshTable;
+
+/* Define the LshIndex structure */
+typedef struct LshIndex {
+    int size;
+    int tables_count;
+    int bits; // sampled dimensions per key, at most 32
+    int *dimensions; // tables_count * bits sampled dimensions
+    LshTable *tables;
+    int count; // indexed space positions
+    int capacity; // allocated length of the next arrays
+} LshIndex;
+
+/* Function prototypes */
+LshIndex *create_lsh_index(Space *space, int tables, int bits, int seed);
+void free_lsh_index(LshIndex *index);
+void lsh_insert(LshIndex *index, Vector *vec, int position);
+void lsh_search(Space *space, Vector **queries, int nq, int k, int probes, const char *method, int *out_ids, double *out_dists);
+
+/* Function implementations */
+
+/* Get the sampled bit of a dimension, following the packed encoding */
+static inline uint32_t lsh_bit(Vector *vec, bool binary, int dimension) {
+    if (vec->packed) {
+        return (uint32_t)((vec->bits[dimension / 64] >> (dimension % 64)) & 1);
+    }
+    return binary ? vec->vector[dimension] > 0 : vec->vector[dimension] < 0;
+}
+
+/* Compute the key of a vector in a table */
+static uint32_t lsh_key(LshIndex *index, int table, Vector *vec) {
+    bool binary = strcmp(vec->vtype, "binary") == 0;
+    const int *dimensions = index->dimensions + (size_t)table * index->bits;
+    uint32_t key = 0;
+    for (int i = 0; i < index->bits; i++) {
+        key |= lsh_bit(vec, binary, dimensions[i]) << i;
+    }
+    return key;
+}
+
+/* Find the slot of a key in a table, or the empty slot where it would go */
+static int lsh_slot(LshTable *table, uint32_t key) {
+    int mask = table->capacity - 1;
+    int slot = (int)((key * UINT32_C(0x9E3779B1)) & mask);
+    while (table->heads[slot] != -1 && table->keys[slot] != key) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/* Double the slots of a table and rehash its keys */
+static void lsh_table_grow(LshTable *table) {
+    LshTable grown = *table;
+    grown.capacity = table->capacity ? table->capacity * 2 : 256;
+    grown.keys = (uint32_t *)malloc(grown.capacity * sizeof(uint32_t));
+    grown.heads = (int *)malloc(grown.capacity * sizeof(int));
+    if (!grown.keys || !grown.heads) {
+        perror("Failed to allocate memory for LSH table");
+        exit(EXIT_FAILURE);
+    }
+    memset(grown.heads, -1, grown.capacity * sizeof(int));
+    for (int i = 0; i < table->capacity; i++) {
+        if (table->heads[i] != -1) {
+            int slot = lsh_slot(&grown, table->keys[i]);
+            grown.keys[slot] = table->keys[i];
+            grown.heads[slot] = table->heads[i];
+        }
+    }
+    free(table->keys);
+    free(table->heads);
+    *table = grown;
+}
+
+/* Create an index over a Space and keep it up to date on every insert_vector */
+LshIndex *create_lsh_index(Space *space, int tables, int bits, int seed) {
+    if (tables < 1) {
+        fprintf(stderr, "The number of LSH tables must be greater than 0\n");
+        exit(EXIT_FAILURE);
+    }
+    if (bits < 1 || bits > 32) {
+        fprintf(stderr, "The number of bits per LSH key must be between 1 and 32\n");
+        exit(EXIT_FAILURE);
+    }
+    if (space->ann) {
+        fprintf(stderr, "The space is already indexed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    LshIndex *index = (LshIndex *)malloc(sizeof(LshIndex));
+    if (!index) {
+        perror("Failed to allocate memory for LshIndex");
+        exit(EXIT_FAILURE);
+    }
+    index->size = space->size;
+    index->tables_count = tables;
+    index->bits = bits;
+    index->count = 0;
+    index->capacity = 0;
+    index->dimensions = (int *)malloc((size_t)tables * bits * sizeof(int));
+    index->tables = (LshTable *)calloc(tables, sizeof(LshTable));
+    if (!index->dimensions || !index->tables) {
+        perror("Failed to allocate memory for LshIndex");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Sample distinct dimensions for every table */
+    Rng rng;
+    rng_init(&rng, seed != -1 ? (uint64_t)seed : rng_entropy_seed(), hash_string("__lsh__"));
+    for (int t = 0; t < tables; t++) {
+        int *dimensions = index->dimensions + (size_t)t * bits;
+        for (int i = 0; i < bits; i++) {
+            bool repeated;
+            do {
+                dimensions[i] = (int)rng_bounded(&rng, space->size);
+                repeated = false;
+                for (int j = 0; j < i; j++) {
+                    repeated |= dimensions[j] == dimensions[i];
+                }
+            } while (repeated);
+        }
+        lsh_table_grow(&index->tables[t]);
+    }
+
+    for (int i = 0; i < space->vector_count; i++) {
+        lsh_insert(index, space->vectors[i], i);
+    }
+    /* space.c keeps the index up to date through these hooks, without linking against lsh.c */
+    space->ann = index;
+    space->ann_insert = lsh_insert;
+    space->ann_free = free_lsh_index;
+    return index;
+}
+
+/* Free an LshIndex */
+void free_lsh_index(LshIndex *index) {
+    if (index) {
+        for (int t = 0; t < index->tables_count; t++) {
+            free(index->tables[t].keys);
+            free(index->tables[t].heads);
+            free(index->tables[t].next);
+        }
+        free(index->tables);
+        free(index->dimensions);
+        free(index);
+    }
+}
+
+/* Add the vector stored at a space position to every table */
+void lsh_insert(LshIndex *index, Vector *vec, int position) {
+    if (position != index->count) {
+        fprintf(stderr, "Vectors must be indexed in space order\n");
+        exit(EXIT_FAILURE);
+    }
+    if (index->count == index->capacity) {
+        index->capacity = index->capacity ? index->capacity * 2 : 1024;
+        for (int t = 0; t < index->tables_count; t++) {
+            index->tables[t].next = (int *)realloc(index->tables[t].next, index->capacity * sizeof(int));
+            if (!index->tables[t].next) {
+                perror("Failed to allocate memory for LSH table");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    for (int t = 0; t < index->tables_count; t++) {
+        LshTable *table = &index->tables[t];
+        if (2 * (table->used + 1) > table->capacity) {
+            lsh_table_grow(table);
+        }
+        uint32_t key = lsh_key(index, t, vec);
+        int slot = lsh_slot(table, key);
+        if (table->heads[slot] == -1) {
+            table->keys[slot] = key;
+            table->used++;
+        }
+        table->next[position] = table->heads[slot];
+        table->heads[slot] = position;
+    }
+    index->count++;
+}
+
+/* Neighbour candidate of an approximate search */
+typedef struct LshHit {
+    double distance;
+    int position;
+} LshHit;
+
+/* Order candidates by distance, then by position */
+static int compare_lsh_hits(const void *a, const void *b) {
+    const LshHit *x = (const LshHit *)a;
+    const LshHit *y = (const LshHit *)b;
+    if (x->distance != y->distance) {
+        return x->distance < y->distance ? -1 : 1;
+    }
+    return (x->position > y->position) - (x->position < y->position);
+}
+
+/* Find approximately the k nearest vectors of an indexed Space for each query
+ * Every table is probed with the query key and with up to probes keys that differ
+ * from it by one bit. Output layout follows space_search. */
+void lsh_search(Space *space, Vector **queries, int nq, int k, int probes, const char *method, int *out_ids, double *out_dists) {
+    LshIndex *index = space->ann;
+    if (!index) {
+        fprintf(stderr, "The space has no approximate nearest-neighbour index\n");
+        exit(EXIT_FAILURE);
+    }
+    if (k <= 0) {
+        fprintf(stderr, "The number of neighbours must be greater than 0\n");
+        exit(EXIT_FAILURE);
+    }
+    if (probes > index->bits) {
+        probes = index->bits;
+    }
+    DistanceMethod distance_method = parse_distance_method(method);
+    for (int q = 0; q < nq; q++) {
+        if (queries[q]->size != space->size || strcmp(queries[q]->vtype, space->vtype) != 0) {
+            fprintf(stderr, "Query \"%s\" is not compatible with the space\n", queries[q]->name);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    uint64_t *seen = (uint64_t *)malloc(((size_t)index->count + 63) / 64 * sizeof(uint64_t));
+    int hits_capacity = 1024;
+    LshHit *hits = (LshHit *)malloc(hits_capacity * sizeof(LshHit));
+    if (!seen || !hits) {
+        perror("Failed to allocate memory for approximate search");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int q = 0; q < nq; q++) {
+        memset(seen, 0, ((size_t)index->count + 63) / 64 * sizeof(uint64_t));
+        int hits_count = 0;
+        for (int t = 0; t < index->tables_count; t++) {
+            LshTable *table = &index->tables[t];
+            uint32_t key = lsh_key(index, t, queries[q]);
+            for (int probe = -1; probe < probes; probe++) {
+                uint32_t probe_key = probe < 0 ? key : key ^ (UINT32_C(1) << probe);
+                int slot = lsh_slot(table, probe_key);
+                for (int position = table->heads[slot]; position != -1; position = table->next[position]) {
+                    if (seen[position / 64] & (UINT64_C(1) << (position % 64))) {
+                        continue;
+                    }
+                    seen[position / 64] |= UINT64_C(1) << (position % 64);
+                    if (hits_count == hits_capacity) {
+                        hits_capacity *= 2;
+                        hits = (LshHit *)realloc(hits, hits_capacity * sizeof(LshHit));
+                        if (!hits) {
+                            perror("Failed to allocate memory for approximate search");
+                            exit(EXIT_FAILURE);
+                        }
+                    }
+                    hits[hits_count].distance = vector_distance_by(queries[q], space->vectors[position], distance_method);
+                    hits[hits_count].position = position;
+                    hits_count++;
+                }
+            }
+        }
+        qsort(hits, hits_count, sizeof(LshHit), compare_lsh_hits);
+        for (int i = 0; i < k; i++) {
+            out_ids[(size_t)q * k + i] = i < hits_count ? hits[i].position : -1;
+            out_dists[(size_t)q * k + i] = i < hits_count ? hits[i].distance : INFINITY;
+        }
+    }
+
+    free(seen);
+    free(hits);
+}
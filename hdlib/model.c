@@ -4,12 +4,25 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <math.h>
 #include <time.h>
+#include <pthread.h>
+#include <unistd.h>
 
 /* Assuming the Vector and Space structures and functions are defined as in previous implementations */
 /* Include the definitions of Vector and Space here or in a separate header file */
 
+/* Strategies for mapping feature values to levels */
+typedef enum Binning {
+    BINNING_GLOBAL, // equal-width bins between the min and max over all features
+    BINNING_FEATURE, // equal-width bins between the min and max of each feature
+    BINNING_QUANTILE // equal-frequency bins over the values of each feature
+} Binning;
+
+/* Dataset read in batches of rows, defined in parser.c */
+typedef struct DatasetStream DatasetStream;
+
 /* Define the MLModel structure */
 typedef struct MLModel {
     int size;
@@ -19,20 +32,59 @@ typedef struct MLModel {
     char **classes;
     int classes_count;
     char *version;
+    int threads; // worker threads, 0 for one per online CPU
+    int max_iterations; // retraining iterations in predict_mlmodel, 0 to disable
+    Binning binning;
+    int num_features;
+    double *min_values; // per feature lower bound of the first level
+    double *max_values; // per feature upper bound of the last level
+    double *bin_edges; // num_features rows of levels-1 sorted edges, quantile binning only
+    Vector **level_vectors; // indexed by level, owned by the space
+    bool *selected_features; // features in the encoding after a stepwise selection, NULL for all
+    int num_points;
+    Vector **point_vectors; // indexed by point, owned by the space; unpacked bundle counts, not binarized
+    int *point_classes; // class index of each point, -1 when unlabeled
+    bool *point_trained; // whether each point is summed into its class accumulator
+    BundleAccumulator *class_accumulators; // per class sum of the trained points
+    Vector **class_vectors; // per class prototype, rebuilt from its accumulator when dirty
+    bool *class_dirty;
+    ThreadPool *pool; // worker threads shared by all the parallel steps, NULL until needed
+    int scratch_workers; // workers with scratch buffers below, 0 until needed
+    BundleAccumulator *scratch_accumulators; // one per worker
+    Vector **scratch_vectors; // one encoded row per worker
+    double *scratch_distances; // classes_count per worker
     // You can add more fields as needed
 } MLModel;
 
 /* Function prototypes */
 MLModel *create_mlmodel(int size, int levels, const char *vtype);
 void free_mlmodel(MLModel *model);
+void set_mlmodel_threads(MLModel *model, int threads);
+void set_mlmodel_retraining(MLModel *model, int max_iterations);
+void set_mlmodel_binning(MLModel *model, Binning binning);
+void mlmodel_add_point(MLModel *model, int point_idx);
+void mlmodel_remove_point(MLModel *model, int point_idx);
+void mlmodel_predict_batch(MLModel *model, double **rows, int n, int k, const char **out_labels, double *out_scores);
 void fit_mlmodel(MLModel *model, double **points, int num_points, int num_features, char **labels, int num_labels, int seed);
+void fit_mlmodel_stream(MLModel *model, const char *filepath, const char *sep, int batch_rows, bool two_pass, int seed);
 void predict_mlmodel(MLModel *model, int *test_indices, int num_test_indices, char **predictions, int *retraining_iterations, double *model_error_rate);
-void cross_val_predict_mlmodel(MLModel *model, double **points, int num_points, int num_features, char **labels, int num_labels, int cv);
-void auto_tune_mlmodel(MLModel *model, double **points, int num_points, int num_features, char **labels, int num_labels, int *size_range, int size_range_length, int *levels_range, int levels_range_length, int cv);
-void stepwise_regression_mlmodel(MLModel *model, double **points, int num_points, int num_features, char **features, int num_features_list, char **labels, int num_labels, const char *method, int cv);
+void cross_val_predict_mlmodel(MLModel *model, double **points, int num_points, int num_features, char **labels, int num_labels, int cv, int seed, char **predictions, double *accuracy);
+void auto_tune_mlmodel(MLModel *model, double **points, int num_points, int num_features, char **labels, int num_labels, int *size_range, int size_range_length, int *levels_range, int levels_range_length, int cv, int seed, int *best_size, int *best_levels, double *best_accuracy);
+void stepwise_regression_mlmodel(MLModel *model, double **points, int num_points, int num_features, char **features, int num_features_list, char **labels, int num_labels, const char *method, int cv, int seed, int *selected, int *num_selected, double *accuracy);
 
 /* Additional helper functions */
 Vector *get_vector_from_space(Space *space, const char *name);
+ThreadPool *create_thread_pool(int threads);
+void free_thread_pool(ThreadPool *pool);
+int thread_pool_size(ThreadPool *pool);
+void parallel_for(ThreadPool *pool, int count, int grain, PoolTask task, void *context);
+DatasetStream *open_dataset_stream(const char *filepath, const char *sep);
+int dataset_stream_num_features(DatasetStream *stream);
+int read_dataset_stream(DatasetStream *stream, double *values, int *labels, int max_rows);
+void rewind_dataset_stream(DatasetStream *stream);
+int dataset_stream_classes_count(DatasetStream *stream);
+const char *dataset_stream_class(DatasetStream *stream, int label);
+void close_dataset_stream(DatasetStream *stream);
 
 /* Function implementations */
 
@@ -62,12 +114,73 @@ MLModel *create_mlmodel(int size, int levels, const char *vtype) {
     model->classes = NULL;
     model->classes_count = 0;
     model->version = strdup("0.1.17"); // Assuming version
+    model->threads = 0;
+    model->max_iterations = 0;
+    model->binning = BINNING_GLOBAL;
+    model->num_features = 0;
+    model->min_values = NULL;
+    model->max_values = NULL;
+    model->bin_edges = NULL;
+    model->level_vectors = NULL;
+    model->selected_features = NULL;
+    model->num_points = 0;
+    model->point_vectors = NULL;
+    model->point_classes = NULL;
+    model->point_trained = NULL;
+    model->class_accumulators = NULL;
+    model->class_vectors = NULL;
+    model->class_dirty = NULL;
+    model->pool = NULL;
+    model->scratch_workers = 0;
+    model->scratch_accumulators = NULL;
+    model->scratch_vectors = NULL;
+    model->scratch_distances = NULL;
     return model;
 }
 
+/* Free the scratch buffers of mlmodel_predict_batch */
+static void free_mlmodel_scratch(MLModel *model) {
+    for (int i = 0; i < model->scratch_workers; i++) {
+        bundle_accumulator_free(&model->scratch_accumulators[i]);
+        free_vector(model->scratch_vectors[i]);
+    }
+    free(model->scratch_accumulators);
+    free(model->scratch_vectors);
+    free(model->scratch_distances);
+    model->scratch_workers = 0;
+    model->scratch_accumulators = NULL;
+    model->scratch_vectors = NULL;
+    model->scratch_distances = NULL;
+}
+
+/* Free the points and class prototypes of a fitted MLModel */
+static void free_mlmodel_prototypes(MLModel *model) {
+    free_mlmodel_scratch(model);
+    if (model->class_accumulators) {
+        for (int i = 0; i < model->classes_count; i++) {
+            bundle_accumulator_free(&model->class_accumulators[i]);
+            free_vector(model->class_vectors[i]);
+        }
+    }
+    free(model->class_accumulators);
+    free(model->class_vectors);
+    free(model->class_dirty);
+    free(model->point_vectors);
+    free(model->point_classes);
+    free(model->point_trained);
+    model->class_accumulators = NULL;
+    model->class_vectors = NULL;
+    model->class_dirty = NULL;
+    model->point_vectors = NULL;
+    model->point_classes = NULL;
+    model->point_trained = NULL;
+    model->num_points = 0;
+}
+
 /* Free an MLModel */
 void free_mlmodel(MLModel *model) {
     if (model) {
+        free_mlmodel_prototypes(model);
         free_space(model->space);
         free(model->vtype);
         for (int i = 0; i < model->classes_count; i++) {
@@ -75,74 +188,292 @@ void free_mlmodel(MLModel *model) {
         }
         free(model->classes);
         free(model->version);
+        free(model->min_values);
+        free(model->max_values);
+        free(model->bin_edges);
+        free(model->level_vectors);
+        free(model->selected_features);
+        if (model->pool) {
+            free_thread_pool(model->pool);
+        }
         free(model);
     }
 }
 
-/* Fit the MLModel */
-void fit_mlmodel(MLModel *model, double **points, int num_points, int num_features, char **labels, int num_labels, int seed) {
-    if (num_points < 3) {
-        fprintf(stderr, "Not enough data points\n");
+/* Set the number of worker threads used by the MLModel, 0 for one per online CPU */
+void set_mlmodel_threads(MLModel *model, int threads) {
+    model->threads = threads > 0 ? threads : 0;
+    free_mlmodel_scratch(model);
+    if (model->pool) {
+        free_thread_pool(model->pool);
+        model->pool = NULL;
+    }
+}
+
+/* Get the thread pool of the MLModel, created on first use */
+static ThreadPool *mlmodel_pool(MLModel *model) {
+    if (!model->pool) {
+        model->pool = create_thread_pool(model->threads);
+    }
+    return model->pool;
+}
+
+/* Set the maximum number of retraining iterations of predict_mlmodel, 0 to disable retraining */
+void set_mlmodel_retraining(MLModel *model, int max_iterations) {
+    model->max_iterations = max_iterations > 0 ? max_iterations : 0;
+}
+
+/* Set the strategy used by fit_mlmodel to map feature values to levels */
+void set_mlmodel_binning(MLModel *model, Binning binning) {
+    if (binning != BINNING_GLOBAL && binning != BINNING_FEATURE && binning != BINNING_QUANTILE) {
+        fprintf(stderr, "Unknown binning strategy\n");
         exit(EXIT_FAILURE);
     }
-    if (labels && num_points != num_labels) {
-        fprintf(stderr, "The number of data points does not match the number of class labels\n");
+    model->binning = binning;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Start fitting the encoder of rows of num_features values, with empty bounds */
+static void reset_mlmodel_encoder(MLModel *model, int num_features) {
+    free(model->min_values);
+    free(model->max_values);
+    free(model->bin_edges);
+    model->num_features = num_features;
+    model->min_values = (double *)malloc(num_features * sizeof(double));
+    model->max_values = (double *)malloc(num_features * sizeof(double));
+    model->bin_edges = NULL;
+    if (model->binning == BINNING_QUANTILE) {
+        model->bin_edges = (double *)malloc((size_t)num_features * (model->levels - 1) * sizeof(double));
+    }
+    if (!model->min_values || !model->max_values || (model->binning == BINNING_QUANTILE && !model->bin_edges)) {
+        perror("Failed to allocate memory for the encoder");
         exit(EXIT_FAILURE);
     }
-    if (labels) {
-        // Collect unique classes
-        model->classes = (char **)malloc(num_labels * sizeof(char *));
-        model->classes_count = 0;
-        for (int i = 0; i < num_labels; i++) {
-            bool exists = false;
-            for (int j = 0; j < model->classes_count; j++) {
-                if (strcmp(labels[i], model->classes[j]) == 0) {
-                    exists = true;
-                    break;
-                }
+    for (int j = 0; j < num_features; j++) {
+        model->min_values[j] = INFINITY;
+        model->max_values[j] = -INFINITY;
+    }
+}
+
+/* Widen the per feature bounds of the encoder to a block of rows */
+static void update_mlmodel_bounds(MLModel *model, double **points, int num_points) {
+    // Single row-major pass, the inner loop has no cross-feature dependency
+    double *min_values = model->min_values;
+    double *max_values = model->max_values;
+    for (int i = 0; i < num_points; i++) {
+        const double *row = points[i];
+        for (int j = 0; j < model->num_features; j++) {
+            min_values[j] = row[j] < min_values[j] ? row[j] : min_values[j];
+            max_values[j] = row[j] > max_values[j] ? row[j] : max_values[j];
+        }
+    }
+}
+
+/* Finish fitting the encoder: share the bounds of all features under global binning,
+ * or place the bin edges at the quantiles of a sample of the rows */
+static void finish_mlmodel_encoder(MLModel *model, double **sample, int sample_size) {
+    int num_features = model->num_features;
+    double *min_values = model->min_values;
+    double *max_values = model->max_values;
+    if (model->binning == BINNING_GLOBAL) {
+        double min_value = INFINITY;
+        double max_value = -INFINITY;
+        for (int j = 0; j < num_features; j++) {
+            min_value = min_values[j] < min_value ? min_values[j] : min_value;
+            max_value = max_values[j] > max_value ? max_values[j] : max_value;
+        }
+        for (int j = 0; j < num_features; j++) {
+            min_values[j] = min_value;
+            max_values[j] = max_value;
+        }
+    } else if (model->binning == BINNING_QUANTILE) {
+        double *columns = (double *)malloc((size_t)num_features * sample_size * sizeof(double));
+        if (!columns) {
+            perror("Failed to allocate memory for the encoder");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < sample_size; i++) {
+            for (int j = 0; j < num_features; j++) {
+                columns[(size_t)j * sample_size + i] = sample[i][j];
             }
-            if (!exists) {
-                model->classes[model->classes_count++] = strdup(labels[i]);
+        }
+        // Edge k is the value at rank k*n/levels, so each bin holds about n/levels values
+        for (int j = 0; j < num_features; j++) {
+            double *column = columns + (size_t)j * sample_size;
+            double *edges = model->bin_edges + (size_t)j * (model->levels - 1);
+            qsort(column, sample_size, sizeof(double), compare_doubles);
+            for (int k = 1; k < model->levels; k++) {
+                edges[k - 1] = column[(size_t)k * sample_size / model->levels];
             }
         }
-        if (model->classes_count < 2) {
-            fprintf(stderr, "The number of unique class labels must be > 1\n");
-            exit(EXIT_FAILURE);
+        free(columns);
+    }
+}
+
+/* Compute the per feature bounds and bin edges of the encoder */
+static void fit_mlmodel_encoder(MLModel *model, double **points, int num_points, int num_features) {
+    reset_mlmodel_encoder(model, num_features);
+    update_mlmodel_bounds(model, points, num_points);
+    finish_mlmodel_encoder(model, points, num_points);
+}
+
+/* Map the value of a feature to its level */
+static inline int mlmodel_level(const MLModel *model, int feature, double value) {
+    if (model->bin_edges) {
+        // Number of edges lower than or equal to the value
+        const double *edges = model->bin_edges + (size_t)feature * (model->levels - 1);
+        int low = 0;
+        int high = model->levels - 1;
+        while (low < high) {
+            int mid = (low + high) >> 1;
+            if (edges[mid] <= value) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
         }
+        return low;
     }
-    // Initialize random number generator
-    if (seed != -1) {
-        srand(seed);
-    } else {
-        srand(time(NULL));
+    double min_value = model->min_values[feature];
+    double range = model->max_values[feature] - min_value;
+    if (!(range > 0.0) || !(value > min_value)) {
+        return 0;
     }
-    // Create level vectors
-    int index_vector_size = model->size;
-    int *index_vector = (int *)malloc(index_vector_size * sizeof(int));
-    for (int i = 0; i < index_vector_size; i++) {
-        index_vector[i] = i;
+    int level = (int)((value - min_value) * model->levels / range);
+    return level < model->levels ? level : model->levels - 1;
+}
+
+/* Check that a point exists and has a class */
+static void check_mlmodel_point(MLModel *model, int point_idx) {
+    if (point_idx < 0 || point_idx >= model->num_points) {
+        fprintf(stderr, "Point %d is not in the model\n", point_idx);
+        exit(EXIT_FAILURE);
+    }
+    if (model->point_classes[point_idx] < 0) {
+        fprintf(stderr, "Point %d has no class label\n", point_idx);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Add a point back into its class prototype */
+void mlmodel_add_point(MLModel *model, int point_idx) {
+    check_mlmodel_point(model, point_idx);
+    if (model->point_trained[point_idx]) {
+        return;
+    }
+    int class_idx = model->point_classes[point_idx];
+    // Point counts are bounded by the number of encoded features
+    bundle_accumulator_add_view(&model->class_accumulators[class_idx], vector_view(model->point_vectors[point_idx], 0), 1, model->num_features);
+    model->point_trained[point_idx] = true;
+    model->class_dirty[class_idx] = true;
+}
+
+/* Remove a point from its class prototype */
+void mlmodel_remove_point(MLModel *model, int point_idx) {
+    check_mlmodel_point(model, point_idx);
+    if (!model->point_trained[point_idx]) {
+        return;
+    }
+    int class_idx = model->point_classes[point_idx];
+    bundle_accumulator_add_view(&model->class_accumulators[class_idx], vector_view(model->point_vectors[point_idx], 0), -1, model->num_features);
+    model->point_trained[point_idx] = false;
+    model->class_dirty[class_idx] = true;
+}
+
+/* Get the prototype of a class, rebuilding it only if its points changed */
+static Vector *mlmodel_class_vector(MLModel *model, int class_idx) {
+    if (model->class_dirty[class_idx]) {
+        bundle_accumulator_counts(&model->class_accumulators[class_idx], model->class_vectors[class_idx]);
+        model->class_dirty[class_idx] = false;
+    }
+    return model->class_vectors[class_idx];
+}
+
+/* Index of the class vector closest to a vector */
+static int mlmodel_closest_class(MLModel *model, Vector *vec, Vector **class_vectors) {
+    int closest_class = 0;
+    double closest_dist = INFINITY;
+    for (int j = 0; j < model->classes_count; j++) {
+        double distance = vector_distance_by(vec, class_vectors[j], DISTANCE_COSINE);
+        if (distance < closest_dist) {
+            closest_dist = distance;
+            closest_class = j;
+        }
     }
+    return closest_class;
+}
+
+/* Add the rotated level vectors of the (selected) features of a row to an accumulator;
+ * the row counts as one added vector, as when its point vector is added to a class */
+static void mlmodel_encode_into(MLModel *model, const double *row, BundleAccumulator *acc) {
+    int added = 0;
+    for (int feature_idx = 0; feature_idx < model->num_features; feature_idx++) {
+        if (model->selected_features && !model->selected_features[feature_idx]) {
+            continue;
+        }
+        Vector *level_vector = model->level_vectors[mlmodel_level(model, feature_idx, row[feature_idx])];
+        bundle_accumulator_add_view(acc, vector_view(level_vector, feature_idx), 1, 1);
+        added++;
+    }
+    acc->count += 1 - added;
+}
+
+/* Sum the rotated level vectors of the (selected) features of a row into an accumulator */
+static void mlmodel_encode(MLModel *model, const double *row, BundleAccumulator *acc) {
+    bundle_accumulator_reset(acc);
+    mlmodel_encode_into(model, row, acc);
+}
+
+/* Shared state of the parallel encoding in fit_mlmodel */
+typedef struct FitContext {
+    MLModel *model;
+    double **points;
+    Vector **encoded; // one vector per point
+    BundleAccumulator *accumulators; // one per worker
+} FitContext;
+
+/* Encode the data points in [begin, end)
+ * Points keep the raw counts of their bundle in unpacked vectors: packing would
+ * binarize them and lose the counts the class sums and cosine distances are built on */
+static void encode_points_task(void *context, int begin, int end, int worker) {
+    FitContext *fit = (FitContext *)context;
+    MLModel *model = fit->model;
+    BundleAccumulator *acc = &fit->accumulators[worker];
+    for (int point_idx = begin; point_idx < end; point_idx++) {
+        mlmodel_encode(model, fit->points[point_idx], acc);
+        char point_name[50];
+        sprintf(point_name, "point_%d", point_idx);
+        Vector *sum_vector = alloc_vector(point_name, model->size, model->vtype, false);
+        bundle_accumulator_counts(acc, sum_vector);
+        fit->encoded[point_idx] = sum_vector;
+    }
+}
+
+/* Create the level vectors in the space, flipping bits drawn from the seed */
+static void create_mlmodel_levels(MLModel *model, int seed) {
+    // Initialize random number generator
+    Rng rng;
+    rng_init(&rng, seed != -1 ? (uint64_t)seed : rng_entropy_seed(), hash_string("levels"));
+    int index_vector_size = model->size;
     int next_level = (int)((model->size / 2) / model->levels);
     int change = model->size / 2;
     // Initialize base vector
+    bool bipolar = strcmp(model->vtype, "bipolar") == 0;
     int *base_vector = (int *)malloc(model->size * sizeof(int));
-    for (int i = 0; i < model->size; i++) {
-        base_vector[i] = strcmp(model->vtype, "bipolar") == 0 ? -1 : 0;
+    free(model->level_vectors);
+    model->level_vectors = (Vector **)malloc(model->levels * sizeof(Vector *));
+    if (!base_vector || !model->level_vectors) {
+        perror("Failed to allocate memory for level vectors");
+        exit(EXIT_FAILURE);
     }
-    // Find min and max values in points
-    double min_value = INFINITY;
-    double max_value = -INFINITY;
-    for (int i = 0; i < num_points; i++) {
-        for (int j = 0; j < num_features; j++) {
-            if (points[i][j] < min_value) {
-                min_value = points[i][j];
-            }
-            if (points[i][j] > max_value) {
-                max_value = points[i][j];
-            }
-        }
+    for (int i = 0; i < model->size; i++) {
+        base_vector[i] = bipolar ? -1 : 0;
     }
-    double gap = (max_value - min_value) / model->levels;
     // Create level vectors
     for (int level_count = 0; level_count < model->levels; level_count++) {
         char level_name[50];
@@ -150,145 +481,1282 @@ void fit_mlmodel(MLModel *model, double **points, int num_points, int num_featur
         if (level_count == 0) {
             // Flip bits
             for (int i = 0; i < change; i++) {
-                int index = rand() % index_vector_size;
-                base_vector[index] *= -1;
+                int index = (int)rng_bounded(&rng, index_vector_size);
+                base_vector[index] = bipolar ? -base_vector[index] : 1 - base_vector[index];
             }
         } else {
             for (int i = 0; i < next_level; i++) {
-                int index = rand() % index_vector_size;
-                base_vector[index] *= -1;
+                int index = (int)rng_bounded(&rng, index_vector_size);
+                base_vector[index] = bipolar ? -base_vector[index] : 1 - base_vector[index];
             }
         }
         // Create vector
-        Vector *level_vector = create_vector(level_name, model->size, model->vtype, -1, false);
+        Vector *level_vector = alloc_vector(level_name, model->size, model->vtype, false);
         memcpy(level_vector->vector, base_vector, model->size * sizeof(int));
         insert_vector(model->space, level_vector);
+        model->level_vectors[level_count] = level_vector;
     }
-    // Encode data points
-    for (int point_idx = 0; point_idx < num_points; point_idx++) {
-        Vector *sum_vector = NULL;
-        for (int feature_idx = 0; feature_idx < num_features; feature_idx++) {
-            double value = points[point_idx][feature_idx];
-            int level_count = 0;
-            if (value == min_value) {
-                level_count = 0;
-            } else if (value == max_value) {
-                level_count = model->levels - 1;
-            } else {
-                for (int level_position = 0; level_position < model->levels; level_position++) {
-                    double left_bound = min_value + (level_position - 1) * gap;
-                    double right_bound = min_value + level_position * gap;
-                    if (left_bound <= value && value < right_bound) {
-                        level_count = level_position;
-                        break;
-                    }
+    free(base_vector);
+}
+
+/* Fit the MLModel */
+void fit_mlmodel(MLModel *model, double **points, int num_points, int num_features, char **labels, int num_labels, int seed) {
+    if (num_points < 3) {
+        fprintf(stderr, "Not enough data points\n");
+        exit(EXIT_FAILURE);
+    }
+    if (labels && num_points != num_labels) {
+        fprintf(stderr, "The number of data points does not match the number of class labels\n");
+        exit(EXIT_FAILURE);
+    }
+    // Refitting replaces the vectors of a previous fit
+    free_mlmodel_prototypes(model);
+    if (model->space->vector_count > 0 || model->space->size != model->size) {
+        free_space(model->space);
+        model->space = create_space(model->size, model->vtype);
+    }
+    model->num_points = num_points;
+    model->point_vectors = (Vector **)malloc(num_points * sizeof(Vector *));
+    model->point_classes = (int *)malloc(num_points * sizeof(int));
+    model->point_trained = (bool *)calloc(num_points, sizeof(bool));
+    if (!model->point_vectors || !model->point_classes || !model->point_trained) {
+        perror("Failed to allocate memory for points");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_points; i++) {
+        model->point_classes[i] = -1;
+    }
+    if (labels) {
+        // Collect unique classes, replacing those of a previous fit
+        for (int i = 0; i < model->classes_count; i++) {
+            free(model->classes[i]);
+        }
+        free(model->classes);
+        model->classes = (char **)malloc(num_labels * sizeof(char *));
+        model->classes_count = 0;
+        for (int i = 0; i < num_labels; i++) {
+            int class_idx = -1;
+            for (int j = 0; j < model->classes_count; j++) {
+                if (strcmp(labels[i], model->classes[j]) == 0) {
+                    class_idx = j;
+                    break;
                 }
             }
-            char level_name[50];
-            sprintf(level_name, "level_%d", level_count);
-            Vector *level_vector = get_vector_from_space(model->space, level_name);
-            Vector *rolled_vector = permute_vector(level_vector, feature_idx);
-            if (!sum_vector) {
-                sum_vector = rolled_vector;
-            } else {
-                Vector *temp = bundle_vectors(sum_vector, rolled_vector);
-                free_vector(sum_vector);
-                sum_vector = temp;
-                free_vector(rolled_vector);
+            if (class_idx < 0) {
+                class_idx = model->classes_count;
+                model->classes[model->classes_count++] = strdup(labels[i]);
             }
+            model->point_classes[i] = class_idx;
         }
-        char point_name[50];
-        sprintf(point_name, "point_%d", point_idx);
-        sum_vector->name = strdup(point_name);
+        if (model->classes_count < 2) {
+            fprintf(stderr, "The number of unique class labels must be > 1\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    // Compute feature bounds and bin edges
+    fit_mlmodel_encoder(model, points, num_points, num_features);
+    free(model->selected_features);
+    model->selected_features = NULL;
+    create_mlmodel_levels(model, seed);
+    // Encode data points in parallel, then insert them in point order
+    ThreadPool *pool = mlmodel_pool(model);
+    FitContext fit;
+    fit.model = model;
+    fit.points = points;
+    fit.encoded = (Vector **)malloc(num_points * sizeof(Vector *));
+    fit.accumulators = (BundleAccumulator *)malloc(thread_pool_size(pool) * sizeof(BundleAccumulator));
+    if (!fit.encoded || !fit.accumulators) {
+        perror("Failed to allocate memory for encoded points");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < thread_pool_size(pool); i++) {
+        bundle_accumulator_init(&fit.accumulators[i], model->size, model->vtype);
+    }
+    parallel_for(pool, num_points, 16, encode_points_task, &fit);
+    for (int point_idx = 0; point_idx < num_points; point_idx++) {
+        Vector *sum_vector = fit.encoded[point_idx];
         insert_vector(model->space, sum_vector);
+        model->point_vectors[point_idx] = sum_vector;
         if (labels) {
             // Add tag (class label)
             add_tag(sum_vector, labels[point_idx]);
         }
     }
-    free(index_vector);
-    free(base_vector);
+    if (labels) {
+        // Build the class prototypes from all the points
+        model->class_accumulators = (BundleAccumulator *)malloc(model->classes_count * sizeof(BundleAccumulator));
+        model->class_vectors = (Vector **)malloc(model->classes_count * sizeof(Vector *));
+        model->class_dirty = (bool *)malloc(model->classes_count * sizeof(bool));
+        if (!model->class_accumulators || !model->class_vectors || !model->class_dirty) {
+            perror("Failed to allocate memory for class prototypes");
+            exit(EXIT_FAILURE);
+        }
+        for (int class_idx = 0; class_idx < model->classes_count; class_idx++) {
+            char class_name[50];
+            sprintf(class_name, "class_%d", class_idx);
+            bundle_accumulator_init(&model->class_accumulators[class_idx], model->size, model->vtype);
+            model->class_vectors[class_idx] = alloc_vector(class_name, model->size, model->vtype, false);
+            add_tag(model->class_vectors[class_idx], model->classes[class_idx]);
+            model->class_dirty[class_idx] = true;
+        }
+        for (int point_idx = 0; point_idx < num_points; point_idx++) {
+            mlmodel_add_point(model, point_idx);
+        }
+    }
+    for (int i = 0; i < thread_pool_size(pool); i++) {
+        bundle_accumulator_free(&fit.accumulators[i]);
+    }
+    free(fit.accumulators);
+    free(fit.encoded);
+}
+
+/* Streaming fit
+ * Rows are parsed in rounds of batches, one batch per worker of the model pool. Each
+ * parallel loop encodes the batches of one round while its first iteration parses the
+ * next round, and every worker sums the rows it encodes into its own class
+ * accumulators, which are merged at the end. Only two rounds of batches are allocated,
+ * so memory does not depend on the size of the dataset. */
+
+/* Values drawn by the reservoir sample of a two-pass streaming fit with quantile binning */
+#define STREAM_SAMPLE_VALUES (1 << 22)
+
+/* Rows of a dataset batch */
+typedef struct StreamBatch {
+    double *values; // rows of num_features values
+    double **rows; // pointer to each row of values
+    int *labels; // class of each row, -1 when unlabeled
+    int count;
+} StreamBatch;
+
+/* Per-worker state of a streaming fit */
+typedef struct StreamWorker {
+    BundleAccumulator *class_accumulators; // per class sum of the rows encoded by the worker
+    int classes_count;
+} StreamWorker;
+
+/* Shared state of a streaming fit */
+typedef struct StreamContext {
+    MLModel *model;
+    DatasetStream *dataset;
+    int batch_rows;
+    StreamWorker *workers;
+    int round_batches; // batches of a round
+    StreamBatch *reading; // round being parsed
+    int reading_count; // filled batches of the round being parsed
+    StreamBatch *encoding; // round being encoded
+    int encoding_count;
+} StreamContext;
+
+/* Parse the next round of batches, stopping at the end of the dataset */
+static void stream_read_round(StreamContext *stream) {
+    stream->reading_count = 0;
+    while (stream->reading_count < stream->round_batches) {
+        StreamBatch *batch = &stream->reading[stream->reading_count];
+        batch->count = read_dataset_stream(stream->dataset, batch->values, batch->labels, stream->batch_rows);
+        if (batch->count == 0) {
+            break;
+        }
+        stream->reading_count++;
+    }
+}
+
+/* Encode the rows of a batch into the class accumulators of a worker */
+static void stream_encode_batch(StreamWorker *worker, MLModel *model, StreamBatch *batch) {
+    for (int i = 0; i < batch->count; i++) {
+        int class_idx = batch->labels[i];
+        if (class_idx < 0) {
+            continue;
+        }
+        if (class_idx >= worker->classes_count) {
+            worker->class_accumulators = (BundleAccumulator *)realloc(worker->class_accumulators, (class_idx + 1) * sizeof(BundleAccumulator));
+            if (!worker->class_accumulators) {
+                perror("Failed to allocate memory for class prototypes");
+                exit(EXIT_FAILURE);
+            }
+            for (int j = worker->classes_count; j <= class_idx; j++) {
+                bundle_accumulator_init(&worker->class_accumulators[j], model->size, model->vtype);
+            }
+            worker->classes_count = class_idx + 1;
+        }
+        // Class sums are linear: adding the level vectors of the row directly gives the
+        // same counts as fit_mlmodel, which adds the point vector of the row to its class
+        mlmodel_encode_into(model, batch->rows[i], &worker->class_accumulators[class_idx]);
+    }
+}
+
+/* Iteration 0 parses the next round, iteration b > 0 encodes batch b - 1 of the current one */
+static void stream_round_task(void *context, int begin, int end, int worker) {
+    StreamContext *stream = (StreamContext *)context;
+    for (int task = begin; task < end; task++) {
+        if (task == 0) {
+            stream_read_round(stream);
+        } else {
+            stream_encode_batch(&stream->workers[worker], stream->model, &stream->encoding[task - 1]);
+        }
+    }
+}
+
+/* Keep only the level vectors in the space of the model, dropping the points of a previous fit */
+static void mlmodel_keep_levels(MLModel *model) {
+    Space *space = create_space(model->size, model->vtype);
+    for (int level = 0; level < model->levels; level++) {
+        Vector *level_vector = alloc_vector(model->level_vectors[level]->name, model->size, model->vtype, false);
+        memcpy(level_vector->vector, model->level_vectors[level]->vector, model->size * sizeof(int));
+        insert_vector(space, level_vector);
+        model->level_vectors[level] = level_vector;
+    }
+    free_space(model->space);
+    model->space = space;
+}
+
+/* First pass of a streaming fit: bounds of all the rows, and a uniform sample of them
+ * (reservoir sampling) for the quantiles */
+static void fit_mlmodel_encoder_stream(MLModel *model, DatasetStream *dataset, StreamBatch *batch, int batch_rows, int seed) {
+    int num_features = dataset_stream_num_features(dataset);
+    reset_mlmodel_encoder(model, num_features);
+    int sample_capacity = STREAM_SAMPLE_VALUES / (num_features > 0 ? num_features : 1);
+    sample_capacity = sample_capacity > model->levels ? sample_capacity : model->levels;
+    double *sample_values = (double *)malloc((size_t)sample_capacity * num_features * sizeof(double));
+    double **sample = (double **)malloc(sample_capacity * sizeof(double *));
+    if (!sample_values || !sample) {
+        perror("Failed to allocate memory for the encoder");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < sample_capacity; i++) {
+        sample[i] = sample_values + (size_t)i * num_features;
+    }
+    Rng rng;
+    rng_init(&rng, seed != -1 ? (uint64_t)seed : rng_entropy_seed(), hash_string("reservoir"));
+    int64_t seen = 0;
+    int count;
+    while ((count = read_dataset_stream(dataset, batch->values, batch->labels, batch_rows)) > 0) {
+        update_mlmodel_bounds(model, batch->rows, count);
+        for (int i = 0; i < count && model->binning == BINNING_QUANTILE; i++, seen++) {
+            // Row number seen replaces a sampled row with probability capacity/(seen+1)
+            int64_t slot = seen < sample_capacity ? seen : (int64_t)rng_bounded(&rng, (uint64_t)seen + 1);
+            if (slot < sample_capacity) {
+                memcpy(sample[slot], batch->rows[i], num_features * sizeof(double));
+            }
+        }
+    }
+    int sample_size = seen < sample_capacity ? (int)seen : sample_capacity;
+    if (model->binning == BINNING_QUANTILE && sample_size == 0) {
+        fprintf(stderr, "Not enough data points\n");
+        exit(EXIT_FAILURE);
+    }
+    finish_mlmodel_encoder(model, sample, sample_size);
+    free(sample_values);
+    free(sample);
+    rewind_dataset_stream(dataset);
 }
 
-/* Predict using the MLModel */
+/* Fit the class prototypes of the MLModel on a dataset file, in the format read by
+ * load_dataset, without loading it. With two_pass the file is read twice: first to fit
+ * the encoder (bounds, and quantiles from a sample of the rows), then to encode the
+ * rows. Otherwise the encoder of a previous fit is kept and the file is read once.
+ * Rows are not kept as points, so the model can predict unseen samples only */
+void fit_mlmodel_stream(MLModel *model, const char *filepath, const char *sep, int batch_rows, bool two_pass, int seed) {
+    if (batch_rows < 1) {
+        fprintf(stderr, "The number of rows per batch must be greater than 0\n");
+        exit(EXIT_FAILURE);
+    }
+    DatasetStream *dataset = open_dataset_stream(filepath, sep);
+    int num_features = dataset_stream_num_features(dataset);
+    if (!two_pass && (!model->level_vectors || model->num_features != num_features)) {
+        fprintf(stderr, "A single pass fit requires an encoder fitted on %d features\n", num_features);
+        exit(EXIT_FAILURE);
+    }
+    ThreadPool *pool = mlmodel_pool(model);
+    int threads = thread_pool_size(pool);
+    // Two rounds of one batch per worker: one being encoded while the other is parsed
+    int batches_count = 2 * threads;
+    StreamBatch *batches = (StreamBatch *)malloc(batches_count * sizeof(StreamBatch));
+    if (!batches) {
+        perror("Failed to allocate memory for batches");
+        exit(EXIT_FAILURE);
+    }
+    for (int b = 0; b < batches_count; b++) {
+        StreamBatch *batch = &batches[b];
+        batch->values = (double *)malloc((size_t)batch_rows * num_features * sizeof(double));
+        batch->rows = (double **)malloc(batch_rows * sizeof(double *));
+        batch->labels = (int *)malloc(batch_rows * sizeof(int));
+        if (!batch->values || !batch->rows || !batch->labels) {
+            perror("Failed to allocate memory for batches");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < batch_rows; i++) {
+            batch->rows[i] = batch->values + (size_t)i * num_features;
+        }
+    }
+
+    // Refitting replaces the points and prototypes of a previous fit
+    free_mlmodel_prototypes(model);
+    if (two_pass) {
+        if (model->space->vector_count > 0 || model->space->size != model->size) {
+            free_space(model->space);
+            model->space = create_space(model->size, model->vtype);
+        }
+        fit_mlmodel_encoder_stream(model, dataset, &batches[0], batch_rows, seed);
+        free(model->selected_features);
+        model->selected_features = NULL;
+        create_mlmodel_levels(model, seed);
+    } else if (model->space->vector_count > model->levels) {
+        mlmodel_keep_levels(model);
+    }
+
+    // Encode each round while the next one is being parsed
+    StreamContext stream;
+    stream.model = model;
+    stream.dataset = dataset;
+    stream.batch_rows = batch_rows;
+    stream.workers = (StreamWorker *)calloc(threads, sizeof(StreamWorker));
+    if (!stream.workers) {
+        perror("Failed to allocate memory for encoder workers");
+        exit(EXIT_FAILURE);
+    }
+    stream.round_batches = threads;
+    stream.reading = batches;
+    stream_read_round(&stream);
+    while (stream.reading_count > 0) {
+        stream.encoding = stream.reading;
+        stream.encoding_count = stream.reading_count;
+        stream.reading = stream.encoding == batches ? batches + threads : batches;
+        parallel_for(pool, stream.encoding_count + 1, 1, stream_round_task, &stream);
+    }
+    StreamWorker *workers = stream.workers;
+
+    // Collect the classes in order of first appearance and merge the worker sums
+    int classes_count = dataset_stream_classes_count(dataset);
+    if (classes_count < 2) {
+        fprintf(stderr, "The number of unique class labels must be > 1\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < model->classes_count; i++) {
+        free(model->classes[i]);
+    }
+    free(model->classes);
+    model->classes = (char **)malloc(classes_count * sizeof(char *));
+    model->classes_count = classes_count;
+    model->class_accumulators = (BundleAccumulator *)malloc(classes_count * sizeof(BundleAccumulator));
+    model->class_vectors = (Vector **)malloc(classes_count * sizeof(Vector *));
+    model->class_dirty = (bool *)malloc(classes_count * sizeof(bool));
+    if (!model->classes || !model->class_accumulators || !model->class_vectors || !model->class_dirty) {
+        perror("Failed to allocate memory for class prototypes");
+        exit(EXIT_FAILURE);
+    }
+    for (int class_idx = 0; class_idx < classes_count; class_idx++) {
+        char class_name[50];
+        sprintf(class_name, "class_%d", class_idx);
+        model->classes[class_idx] = strdup(dataset_stream_class(dataset, class_idx));
+        bundle_accumulator_init(&model->class_accumulators[class_idx], model->size, model->vtype);
+        for (int t = 0; t < threads; t++) {
+            if (class_idx < workers[t].classes_count) {
+                bundle_accumulator_merge(&model->class_accumulators[class_idx], &workers[t].class_accumulators[class_idx]);
+            }
+        }
+        model->class_vectors[class_idx] = alloc_vector(class_name, model->size, model->vtype, false);
+        add_tag(model->class_vectors[class_idx], model->classes[class_idx]);
+        model->class_dirty[class_idx] = true;
+    }
+
+    for (int t = 0; t < threads; t++) {
+        for (int j = 0; j < workers[t].classes_count; j++) {
+            bundle_accumulator_free(&workers[t].class_accumulators[j]);
+        }
+        free(workers[t].class_accumulators);
+    }
+    free(workers);
+    for (int b = 0; b < batches_count; b++) {
+        free(batches[b].values);
+        free(batches[b].rows);
+        free(batches[b].labels);
+    }
+    free(batches);
+    close_dataset_stream(dataset);
+}
+
+/* Training points evaluated in parallel between two retraining updates */
+#define RETRAINING_BATCH 1024
+
+/* Shared state of the parallel evaluation of a retraining batch */
+typedef struct RetrainContext {
+    MLModel *model;
+    Vector **class_vectors;
+    int *points; // training points of the batch
+    int *predicted; // closest class of each point of the batch
+} RetrainContext;
+
+/* Classify the batch points in [begin, end) */
+static void retrain_batch_task(void *context, int begin, int end, int worker) {
+    (void)worker;
+    RetrainContext *retrain = (RetrainContext *)context;
+    for (int i = begin; i < end; i++) {
+        Vector *point = retrain->model->point_vectors[retrain->points[i]];
+        retrain->predicted[i] = mlmodel_closest_class(retrain->model, point, retrain->class_vectors);
+    }
+}
+
+/* Classify the training points batch by batch and count the errors; with update, each
+ * misclassified point is moved from the predicted class to its own one before the next
+ * batch is classified. Only the two class accumulators involved in a mistake change */
+static int mlmodel_retrain_pass(MLModel *model, RetrainContext *retrain, int *training_points, int training_count, bool update) {
+    int errors = 0;
+    for (int start = 0; start < training_count; start += RETRAINING_BATCH) {
+        int batch = training_count - start < RETRAINING_BATCH ? training_count - start : RETRAINING_BATCH;
+        for (int class_idx = 0; class_idx < model->classes_count; class_idx++) {
+            retrain->class_vectors[class_idx] = mlmodel_class_vector(model, class_idx);
+        }
+        retrain->points = training_points + start;
+        parallel_for(mlmodel_pool(model), batch, 16, retrain_batch_task, retrain);
+        for (int i = 0; i < batch; i++) {
+            int point_idx = retrain->points[i];
+            int class_idx = model->point_classes[point_idx];
+            int predicted = retrain->predicted[i];
+            if (predicted == class_idx) {
+                continue;
+            }
+            errors++;
+            if (update) {
+                VectorView point = vector_view(model->point_vectors[point_idx], 0);
+                bundle_accumulator_add_view(&model->class_accumulators[predicted], point, -1, model->num_features);
+                bundle_accumulator_add_view(&model->class_accumulators[class_idx], point, 1, model->num_features);
+                model->class_dirty[predicted] = true;
+                model->class_dirty[class_idx] = true;
+            }
+        }
+    }
+    return errors;
+}
+
+/* Copy the class accumulators of the MLModel into (restore false) or from (restore true) a snapshot */
+static void mlmodel_snapshot_classes(MLModel *model, BundleAccumulator *snapshot, bool restore) {
+    for (int class_idx = 0; class_idx < model->classes_count; class_idx++) {
+        BundleAccumulator *dst = restore ? &model->class_accumulators[class_idx] : &snapshot[class_idx];
+        BundleAccumulator *src = restore ? &snapshot[class_idx] : &model->class_accumulators[class_idx];
+        bundle_accumulator_reset(dst);
+        bundle_accumulator_merge(dst, src);
+        if (restore) {
+            model->class_dirty[class_idx] = true;
+        }
+    }
+}
+
+/* Predict using the MLModel. The trained test points are taken out of their classes for the
+ * prediction and added back afterwards. With retraining enabled the class accumulators are
+ * first refined perceptron-style on the other training points, and keep the refinement;
+ * otherwise the error rate is NAN */
 void predict_mlmodel(MLModel *model, int *test_indices, int num_test_indices, char **predictions, int *retraining_iterations, double *model_error_rate) {
     if (num_test_indices == 0) {
         fprintf(stderr, "No test indices have been provided\n");
         exit(EXIT_FAILURE);
     }
-    // Retrieve test and training vectors
+    if (!model->class_accumulators) {
+        fprintf(stderr, "The model has not been fitted with class labels\n");
+        exit(EXIT_FAILURE);
+    }
+    // Retrieve test vectors
     Vector **test_vectors = (Vector **)malloc(num_test_indices * sizeof(Vector *));
-    int test_count = 0;
-    Vector **training_vectors = NULL;
+    bool *was_trained = (bool *)malloc(num_test_indices * sizeof(bool));
+    bool *is_test = (bool *)calloc(model->num_points, sizeof(bool));
+    int *training_counts = (int *)calloc(model->classes_count, sizeof(int));
+    Vector **class_vectors = (Vector **)malloc(model->classes_count * sizeof(Vector *));
+    if (!test_vectors || !was_trained || !is_test || !training_counts || !class_vectors) {
+        perror("Failed to allocate memory for test vectors");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_test_indices; i++) {
+        int point_idx = test_indices[i];
+        if (point_idx < 0 || point_idx >= model->num_points || is_test[point_idx]) {
+            fprintf(stderr, "Unable to retrieve all the test vectors from the space\n");
+            exit(EXIT_FAILURE);
+        }
+        is_test[point_idx] = true;
+        test_vectors[i] = model->point_vectors[point_idx];
+    }
     int training_count = 0;
-    for (int i = 0; i < model->space->vector_count; i++) {
-        Vector *vec = model->space->vectors[i];
-        if (strncmp(vec->name, "point_", 6) == 0) {
-            int point_idx = atoi(vec->name + 6);
-            bool is_test = false;
-            for (int j = 0; j < num_test_indices; j++) {
-                if (point_idx == test_indices[j]) {
-                    test_vectors[test_count++] = vec;
-                    is_test = true;
-                    break;
+    for (int point_idx = 0; point_idx < model->num_points; point_idx++) {
+        if (model->point_trained[point_idx] && !is_test[point_idx]) {
+            training_counts[model->point_classes[point_idx]]++;
+            training_count++;
+        }
+    }
+    for (int class_idx = 0; class_idx < model->classes_count; class_idx++) {
+        if (training_counts[class_idx] == 0) {
+            fprintf(stderr, "No training vectors for class '%s'\n", model->classes[class_idx]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < num_test_indices; i++) {
+        was_trained[i] = model->point_trained[test_indices[i]];
+        if (was_trained[i]) {
+            mlmodel_remove_point(model, test_indices[i]);
+        }
+    }
+    // Retrain: move misclassified training points from the predicted class to their own one,
+    // until no error is left, the error stops decreasing or the iterations run out. The errors
+    // of a pass score the classes it started from, and the classes with the fewest are kept
+    int iterations = 0;
+    double error_rate = NAN;
+    if (model->max_iterations > 0) {
+        int *training_points = (int *)malloc((training_count + 1) * sizeof(int));
+        int *predicted = (int *)malloc(RETRAINING_BATCH * sizeof(int));
+        BundleAccumulator *pass_classes = (BundleAccumulator *)malloc(model->classes_count * sizeof(BundleAccumulator));
+        BundleAccumulator *best_classes = (BundleAccumulator *)malloc(model->classes_count * sizeof(BundleAccumulator));
+        if (!training_points || !predicted || !pass_classes || !best_classes) {
+            perror("Failed to allocate memory for retraining");
+            exit(EXIT_FAILURE);
+        }
+        for (int class_idx = 0; class_idx < model->classes_count; class_idx++) {
+            bundle_accumulator_init(&pass_classes[class_idx], model->size, model->vtype);
+            bundle_accumulator_init(&best_classes[class_idx], model->size, model->vtype);
+        }
+        training_count = 0;
+        for (int point_idx = 0; point_idx < model->num_points; point_idx++) {
+            if (model->point_trained[point_idx]) {
+                training_points[training_count++] = point_idx;
+            }
+        }
+        RetrainContext retrain;
+        retrain.model = model;
+        retrain.class_vectors = class_vectors;
+        retrain.predicted = predicted;
+        int best_errors = training_count + 1;
+        int previous_errors = training_count + 1;
+        bool current_is_best = false;
+        while (iterations < model->max_iterations) {
+            mlmodel_snapshot_classes(model, pass_classes, false);
+            int errors = mlmodel_retrain_pass(model, &retrain, training_points, training_count, true);
+            iterations++;
+            if (errors < best_errors) {
+                best_errors = errors;
+                BundleAccumulator *swap = best_classes;
+                best_classes = pass_classes;
+                pass_classes = swap;
+            }
+            if (errors == 0 || errors >= previous_errors) {
+                break;
+            }
+            previous_errors = errors;
+            if (iterations == model->max_iterations) {
+                // Score the classes left by the last pass before keeping them
+                errors = mlmodel_retrain_pass(model, &retrain, training_points, training_count, false);
+                if (errors < best_errors) {
+                    best_errors = errors;
+                    current_is_best = true;
+                }
+            }
+        }
+        if (!current_is_best) {
+            mlmodel_snapshot_classes(model, best_classes, true);
+        }
+        error_rate = training_count > 0 ? (double)best_errors / training_count : 0.0;
+        for (int class_idx = 0; class_idx < model->classes_count; class_idx++) {
+            bundle_accumulator_free(&pass_classes[class_idx]);
+            bundle_accumulator_free(&best_classes[class_idx]);
+        }
+        free(pass_classes);
+        free(best_classes);
+        free(training_points);
+        free(predicted);
+    }
+    if (retraining_iterations) {
+        *retraining_iterations = iterations;
+    }
+    if (model_error_rate) {
+        *model_error_rate = error_rate;
+    }
+    // Predict test vectors
+    for (int class_idx = 0; class_idx < model->classes_count; class_idx++) {
+        class_vectors[class_idx] = mlmodel_class_vector(model, class_idx);
+    }
+    for (int i = 0; i < num_test_indices; i++) {
+        predictions[i] = strdup(model->classes[mlmodel_closest_class(model, test_vectors[i], class_vectors)]);
+    }
+    for (int i = 0; i < num_test_indices; i++) {
+        if (was_trained[i]) {
+            mlmodel_add_point(model, test_indices[i]);
+        }
+    }
+    // Free allocated memory
+    free(class_vectors);
+    free(training_counts);
+    free(test_vectors);
+    free(was_trained);
+    free(is_test);
+}
+
+/* Shared state of the parallel classification in mlmodel_predict_batch */
+typedef struct BatchContext {
+    MLModel *model;
+    double **rows;
+    int k;
+    const char **out_labels;
+    double *out_scores;
+} BatchContext;
+
+/* Encode and classify the rows in [begin, end) */
+static void predict_batch_task(void *context, int begin, int end, int worker) {
+    BatchContext *batch = (BatchContext *)context;
+    MLModel *model = batch->model;
+    BundleAccumulator *acc = &model->scratch_accumulators[worker];
+    Vector *encoded = model->scratch_vectors[worker];
+    double *distances = model->scratch_distances + (size_t)worker * model->classes_count;
+    for (int row = begin; row < end; row++) {
+        mlmodel_encode(model, batch->rows[row], acc);
+        bundle_accumulator_counts(acc, encoded);
+        for (int class_idx = 0; class_idx < model->classes_count; class_idx++) {
+            distances[class_idx] = vector_distance_by(encoded, model->class_vectors[class_idx], DISTANCE_COSINE);
+            if (isnan(distances[class_idx])) {
+                // Zero norm (no selected feature or empty class), rank it last
+                distances[class_idx] = 2.0;
+            }
+        }
+        // Select the k closest classes, ties keep the lowest class index
+        const char **labels = batch->out_labels + (size_t)row * batch->k;
+        double *scores = batch->out_scores ? batch->out_scores + (size_t)row * batch->k : NULL;
+        for (int rank = 0; rank < batch->k; rank++) {
+            int closest = 0;
+            for (int class_idx = 1; class_idx < model->classes_count; class_idx++) {
+                if (distances[class_idx] < distances[closest]) {
+                    closest = class_idx;
                 }
             }
-            if (!is_test) {
-                training_vectors = (Vector **)realloc(training_vectors, (training_count + 1) * sizeof(Vector *));
-                training_vectors[training_count++] = vec;
+            labels[rank] = model->classes[closest];
+            if (scores) {
+                scores[rank] = 1.0 - distances[closest];
             }
+            distances[closest] = INFINITY;
         }
     }
-    if (test_count != num_test_indices) {
-        fprintf(stderr, "Unable to retrieve all the test vectors from the space\n");
+}
+
+/* Classify unseen rows without adding them to the space. For each row, the k closest
+ * classes go to out_labels (pointers to the model class names) and their cosine
+ * similarities to out_scores (may be NULL), both n x k row-major and best first.
+ * Scratch buffers and the thread pool are kept in the model, so concurrent calls on
+ * the same model are not supported. */
+void mlmodel_predict_batch(MLModel *model, double **rows, int n, int k, const char **out_labels, double *out_scores) {
+    if (!model->class_accumulators) {
+        fprintf(stderr, "The model has not been fitted with class labels\n");
         exit(EXIT_FAILURE);
     }
-    // Build class vectors
-    Vector **class_vectors = (Vector **)malloc(model->classes_count * sizeof(Vector *));
+    if (k < 1 || k > model->classes_count) {
+        fprintf(stderr, "The number of predicted classes must be between 1 and the number of classes\n");
+        exit(EXIT_FAILURE);
+    }
+    if (n <= 0) {
+        return;
+    }
     for (int class_idx = 0; class_idx < model->classes_count; class_idx++) {
-        Vector *class_vector = NULL;
-        for (int i = 0; i < training_count; i++) {
-            if (has_tag(training_vectors[i], model->classes[class_idx])) {
-                if (!class_vector) {
-                    class_vector = copy_vector(training_vectors[i]);
-                } else {
-                    Vector *temp = bundle_vectors(class_vector, training_vectors[i]);
-                    free_vector(class_vector);
-                    class_vector = temp;
-                }
+        mlmodel_class_vector(model, class_idx);
+    }
+    ThreadPool *pool = mlmodel_pool(model);
+    if (model->scratch_workers == 0) {
+        int workers = thread_pool_size(pool);
+        model->scratch_accumulators = (BundleAccumulator *)malloc(workers * sizeof(BundleAccumulator));
+        model->scratch_vectors = (Vector **)malloc(workers * sizeof(Vector *));
+        model->scratch_distances = (double *)malloc((size_t)workers * model->classes_count * sizeof(double));
+        if (!model->scratch_accumulators || !model->scratch_vectors || !model->scratch_distances) {
+            perror("Failed to allocate memory for batch prediction");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < workers; i++) {
+            bundle_accumulator_init(&model->scratch_accumulators[i], model->size, model->vtype);
+            model->scratch_vectors[i] = alloc_vector("row", model->size, model->vtype, false);
+        }
+        model->scratch_workers = workers;
+    }
+    BatchContext batch;
+    batch.model = model;
+    batch.rows = rows;
+    batch.k = k;
+    batch.out_labels = out_labels;
+    batch.out_scores = out_scores;
+    parallel_for(pool, n, 16, predict_batch_task, &batch);
+}
+
+/* Assignment of the points to cross validation folds */
+typedef struct Folds {
+    int count;
+    int *fold_of; // fold of each point
+    int *points; // point indices grouped by fold, in index order within a fold
+    int *starts; // fold f holds points[starts[f], starts[f + 1])
+} Folds;
+
+/* Assign points to cv folds of equal size with a seeded shuffle */
+static void folds_init(Folds *folds, int num_points, int cv, int seed) {
+    if (cv < 2 || cv > num_points) {
+        fprintf(stderr, "The number of folds must be between 2 and the number of data points\n");
+        exit(EXIT_FAILURE);
+    }
+    folds->count = cv;
+    folds->fold_of = (int *)malloc(num_points * sizeof(int));
+    folds->points = (int *)malloc(num_points * sizeof(int));
+    folds->starts = (int *)calloc(cv + 1, sizeof(int));
+    int *order = (int *)malloc(num_points * sizeof(int));
+    int *fill = (int *)malloc(cv * sizeof(int));
+    if (!folds->fold_of || !folds->points || !folds->starts || !order || !fill) {
+        perror("Failed to allocate memory for folds");
+        exit(EXIT_FAILURE);
+    }
+    Rng rng;
+    rng_init(&rng, seed != -1 ? (uint64_t)seed : rng_entropy_seed(), hash_string("folds"));
+    for (int i = 0; i < num_points; i++) {
+        order[i] = i;
+    }
+    for (int i = num_points - 1; i > 0; i--) {
+        int j = (int)rng_bounded(&rng, (uint64_t)i + 1);
+        int temp = order[i];
+        order[i] = order[j];
+        order[j] = temp;
+    }
+    // Point order[i] goes to fold i % cv
+    for (int i = 0; i < num_points; i++) {
+        folds->fold_of[order[i]] = i % cv;
+        folds->starts[i % cv + 1]++;
+    }
+    for (int fold = 0; fold < cv; fold++) {
+        folds->starts[fold + 1] += folds->starts[fold];
+    }
+    memcpy(fill, folds->starts, cv * sizeof(int));
+    for (int point_idx = 0; point_idx < num_points; point_idx++) {
+        folds->points[fill[folds->fold_of[point_idx]]++] = point_idx;
+    }
+    free(order);
+    free(fill);
+}
+
+/* Free the arrays of a fold assignment */
+static void folds_free(Folds *folds) {
+    free(folds->fold_of);
+    free(folds->points);
+    free(folds->starts);
+}
+
+/* Check that no fold holds all the points of a class of a fitted model */
+static void check_mlmodel_folds(MLModel *model, Folds *folds) {
+    int *training_counts = (int *)malloc((size_t)folds->count * model->classes_count * sizeof(int));
+    if (!training_counts) {
+        perror("Failed to allocate memory for folds");
+        exit(EXIT_FAILURE);
+    }
+    for (int fold = 0; fold < folds->count; fold++) {
+        for (int class_idx = 0; class_idx < model->classes_count; class_idx++) {
+            training_counts[fold * model->classes_count + class_idx] = model->class_accumulators[class_idx].count;
+        }
+    }
+    for (int point_idx = 0; point_idx < model->num_points; point_idx++) {
+        training_counts[folds->fold_of[point_idx] * model->classes_count + model->point_classes[point_idx]]--;
+    }
+    for (int i = 0; i < folds->count * model->classes_count; i++) {
+        if (training_counts[i] == 0) {
+            fprintf(stderr, "No training vectors for class '%s' in fold %d\n", model->classes[i % model->classes_count], i / model->classes_count);
+            exit(EXIT_FAILURE);
+        }
+    }
+    free(training_counts);
+}
+
+/* Shallow copy of the first size elements of an unpacked vector, never to be freed */
+static inline Vector vector_prefix(Vector *vec, int size) {
+    Vector prefix = *vec;
+    prefix.size = size;
+    return prefix;
+}
+
+/* Write into class_vectors the prototypes trained without the points of a fold; class
+ * vectors shorter than the model hold the prototypes of its first dimensions */
+static void mlmodel_fold_prototypes(MLModel *model, Folds *folds, int fold, Vector **class_vectors) {
+    int size = class_vectors[0]->size;
+    for (int class_idx = 0; class_idx < model->classes_count; class_idx++) {
+        memcpy(class_vectors[class_idx]->vector, model->class_vectors[class_idx]->vector, size * sizeof(int));
+    }
+    for (int i = folds->starts[fold]; i < folds->starts[fold + 1]; i++) {
+        int point_idx = folds->points[i];
+        Vector point = vector_prefix(model->point_vectors[point_idx], size);
+        subtract_vectors_inplace(class_vectors[model->point_classes[point_idx]], &point);
+    }
+}
+
+/* Shared state of the parallel folds in cross_val_predict_mlmodel */
+typedef struct CrossValContext {
+    MLModel *model;
+    char **labels;
+    Folds *folds;
+    Vector **scratch; // classes_count class vectors per worker
+    char **predictions;
+    int *fold_correct;
+} CrossValContext;
+
+/* Evaluate the folds in [begin, end) */
+static void cross_val_fold_task(void *context, int begin, int end, int worker) {
+    CrossValContext *cv = (CrossValContext *)context;
+    MLModel *model = cv->model;
+    Folds *folds = cv->folds;
+    Vector **class_vectors = cv->scratch + (size_t)worker * model->classes_count;
+    for (int fold = begin; fold < end; fold++) {
+        mlmodel_fold_prototypes(model, folds, fold, class_vectors);
+        int correct = 0;
+        for (int i = folds->starts[fold]; i < folds->starts[fold + 1]; i++) {
+            int point_idx = folds->points[i];
+            int class_idx = mlmodel_closest_class(model, model->point_vectors[point_idx], class_vectors);
+            cv->predictions[point_idx] = strdup(model->classes[class_idx]);
+            correct += strcmp(model->classes[class_idx], cv->labels[point_idx]) == 0;
+        }
+        cv->fold_correct[fold] = correct;
+    }
+}
+
+/* Predict every point with k-fold cross validation; predictions are indexed by point */
+void cross_val_predict_mlmodel(MLModel *model, double **points, int num_points, int num_features, char **labels, int num_labels, int cv, int seed, char **predictions, double *accuracy) {
+    if (!labels) {
+        fprintf(stderr, "Cross validation requires class labels\n");
+        exit(EXIT_FAILURE);
+    }
+    Folds folds;
+    folds_init(&folds, num_points, cv, seed);
+    // Encode all the points and build the full class prototypes once
+    fit_mlmodel(model, points, num_points, num_features, labels, num_labels, seed);
+    for (int class_idx = 0; class_idx < model->classes_count; class_idx++) {
+        mlmodel_class_vector(model, class_idx);
+    }
+    check_mlmodel_folds(model, &folds);
+    // Evaluate the folds in parallel
+    ThreadPool *pool = mlmodel_pool(model);
+    int workers = thread_pool_size(pool);
+    CrossValContext context;
+    context.model = model;
+    context.labels = labels;
+    context.folds = &folds;
+    context.predictions = predictions;
+    context.fold_correct = (int *)malloc(cv * sizeof(int));
+    context.scratch = (Vector **)malloc((size_t)workers * model->classes_count * sizeof(Vector *));
+    if (!context.fold_correct || !context.scratch) {
+        perror("Failed to allocate memory for class vectors");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < workers * model->classes_count; i++) {
+        context.scratch[i] = alloc_vector(model->class_vectors[i % model->classes_count]->name, model->size, model->vtype, false);
+    }
+    parallel_for(pool, cv, 1, cross_val_fold_task, &context);
+    int correct = 0;
+    for (int fold = 0; fold < cv; fold++) {
+        correct += context.fold_correct[fold];
+    }
+    if (accuracy) {
+        *accuracy = (double)correct / num_points;
+    }
+    for (int i = 0; i < workers * model->classes_count; i++) {
+        free_vector(context.scratch[i]);
+    }
+    free(context.scratch);
+    free(context.fold_correct);
+    folds_free(&folds);
+}
+
+/* Shared state of the parallel grid evaluation in auto_tune_mlmodel */
+typedef struct AutoTuneContext {
+    MLModel *model; // fitted at the largest size with the current number of levels
+    Folds *folds;
+    int *sizes;
+    Vector **scratch; // classes_count largest size class vectors per worker
+    Vector *prefixes; // classes_count prefix views per worker
+    Vector **prefix_vectors; // pointers to the prefix views
+    int *wrong; // misclassified points per size
+    int *folds_done; // evaluated folds per size
+    bool *abandoned; // sizes that cannot beat the best accuracy
+    double *accuracies; // per size, once all its folds are done
+    double best_accuracy; // best accuracy over the completed configurations
+    pthread_mutex_t lock;
+} AutoTuneContext;
+
+/* Evaluate the (size, fold) pairs in [begin, end) */
+static void auto_tune_task(void *context, int begin, int end, int worker) {
+    AutoTuneContext *tune = (AutoTuneContext *)context;
+    MLModel *model = tune->model;
+    Folds *folds = tune->folds;
+    Vector *prefixes = tune->prefixes + (size_t)worker * model->classes_count;
+    Vector **class_vectors = tune->prefix_vectors + (size_t)worker * model->classes_count;
+    for (int task = begin; task < end; task++) {
+        int size_idx = task / folds->count;
+        int fold = task % folds->count;
+        // Skip configurations that cannot catch up with the best one even with no more errors
+        pthread_mutex_lock(&tune->lock);
+        bool skip = tune->abandoned[size_idx];
+        pthread_mutex_unlock(&tune->lock);
+        if (skip) {
+            continue;
+        }
+        for (int class_idx = 0; class_idx < model->classes_count; class_idx++) {
+            prefixes[class_idx] = vector_prefix(tune->scratch[(size_t)worker * model->classes_count + class_idx], tune->sizes[size_idx]);
+            class_vectors[class_idx] = &prefixes[class_idx];
+        }
+        mlmodel_fold_prototypes(model, folds, fold, class_vectors);
+        int wrong = 0;
+        for (int i = folds->starts[fold]; i < folds->starts[fold + 1]; i++) {
+            int point_idx = folds->points[i];
+            Vector point = vector_prefix(model->point_vectors[point_idx], tune->sizes[size_idx]);
+            wrong += mlmodel_closest_class(model, &point, class_vectors) != model->point_classes[point_idx];
+        }
+        pthread_mutex_lock(&tune->lock);
+        tune->wrong[size_idx] += wrong;
+        tune->folds_done[size_idx]++;
+        double bound = (double)(model->num_points - tune->wrong[size_idx]) / model->num_points;
+        if (bound < tune->best_accuracy) {
+            tune->abandoned[size_idx] = true;
+        } else if (tune->folds_done[size_idx] == folds->count) {
+            tune->accuracies[size_idx] = bound;
+            if (bound > tune->best_accuracy) {
+                tune->best_accuracy = bound;
             }
         }
-        if (class_vector) {
-            char class_name[50];
-            sprintf(class_name, "class_%d", class_idx);
-            class_vector->name = strdup(class_name);
-            add_tag(class_vector, model->classes[class_idx]);
-            class_vectors[class_idx] = class_vector;
-        } else {
-            fprintf(stderr, "No training vectors for class '%s'\n", model->classes[class_idx]);
+        pthread_mutex_unlock(&tune->lock);
+    }
+}
+
+/* Find the vector size and number of levels with the best cross validation accuracy,
+ * then refit the model with them */
+void auto_tune_mlmodel(MLModel *model, double **points, int num_points, int num_features, char **labels, int num_labels, int *size_range, int size_range_length, int *levels_range, int levels_range_length, int cv, int seed, int *best_size, int *best_levels, double *best_accuracy) {
+    if (!labels) {
+        fprintf(stderr, "Auto tuning requires class labels\n");
+        exit(EXIT_FAILURE);
+    }
+    if (size_range_length < 1 || levels_range_length < 1) {
+        fprintf(stderr, "Empty range of vector sizes or levels\n");
+        exit(EXIT_FAILURE);
+    }
+    int max_size = 0;
+    for (int i = 0; i < size_range_length; i++) {
+        if (size_range[i] < 10000) {
+            fprintf(stderr, "Vectors size must be greater than or equal to 10000\n");
             exit(EXIT_FAILURE);
         }
+        max_size = size_range[i] > max_size ? size_range[i] : max_size;
     }
-    // Predict test vectors
-    for (int i = 0; i < num_test_indices; i++) {
-        Vector *test_vector = test_vectors[i];
-        char *closest_class = NULL;
-        double closest_dist = INFINITY;
-        for (int j = 0; j < model->classes_count; j++) {
-            Vector *class_vector = class_vectors[j];
-            double distance = vector_distance(test_vector, class_vector, "cosine");
-            if (distance < closest_dist) {
-                closest_dist = distance;
-                closest_class = model->classes[j];
+    if (seed == -1) {
+        seed = (int)(rng_entropy_seed() & INT32_MAX);
+    }
+    Folds folds;
+    folds_init(&folds, num_points, cv, seed);
+    ThreadPool *pool = mlmodel_pool(model);
+    int workers = thread_pool_size(pool);
+    AutoTuneContext tune;
+    tune.folds = &folds;
+    tune.sizes = size_range;
+    tune.wrong = (int *)malloc(size_range_length * sizeof(int));
+    tune.folds_done = (int *)malloc(size_range_length * sizeof(int));
+    tune.abandoned = (bool *)malloc(size_range_length * sizeof(bool));
+    tune.accuracies = (double *)malloc(size_range_length * sizeof(double));
+    tune.best_accuracy = -1.0;
+    pthread_mutex_init(&tune.lock, NULL);
+    if (!tune.wrong || !tune.folds_done || !tune.abandoned || !tune.accuracies) {
+        perror("Failed to allocate memory for auto tuning");
+        exit(EXIT_FAILURE);
+    }
+    int tuned_size = size_range[0];
+    int tuned_levels = levels_range[0];
+    double tuned_accuracy = -1.0;
+    for (int levels_idx = 0; levels_idx < levels_range_length; levels_idx++) {
+        // Encode once at the largest size, smaller sizes use the first dimensions
+        MLModel *encoded = create_mlmodel(max_size, levels_range[levels_idx], model->vtype);
+        encoded->threads = model->threads;
+        encoded->binning = model->binning;
+        // Lend the pool of the tuned model, taken back before the encoding is freed
+        encoded->pool = pool;
+        fit_mlmodel(encoded, points, num_points, num_features, labels, num_labels, seed);
+        for (int class_idx = 0; class_idx < encoded->classes_count; class_idx++) {
+            mlmodel_class_vector(encoded, class_idx);
+        }
+        if (levels_idx == 0) {
+            check_mlmodel_folds(encoded, &folds);
+            tune.scratch = (Vector **)malloc((size_t)workers * encoded->classes_count * sizeof(Vector *));
+            tune.prefixes = (Vector *)malloc((size_t)workers * encoded->classes_count * sizeof(Vector));
+            tune.prefix_vectors = (Vector **)malloc((size_t)workers * encoded->classes_count * sizeof(Vector *));
+            if (!tune.scratch || !tune.prefixes || !tune.prefix_vectors) {
+                perror("Failed to allocate memory for class vectors");
+                exit(EXIT_FAILURE);
+            }
+            for (int i = 0; i < workers * encoded->classes_count; i++) {
+                tune.scratch[i] = alloc_vector("class", max_size, model->vtype, false);
             }
         }
-        predictions[i] = strdup(closest_class);
+        tune.model = encoded;
+        for (int i = 0; i < size_range_length; i++) {
+            tune.wrong[i] = 0;
+            tune.folds_done[i] = 0;
+            tune.abandoned[i] = false;
+        }
+        parallel_for(pool, size_range_length * cv, 1, auto_tune_task, &tune);
+        // Ties keep the earliest configuration of the grid
+        for (int i = 0; i < size_range_length; i++) {
+            if (!tune.abandoned[i] && tune.accuracies[i] > tuned_accuracy) {
+                tuned_accuracy = tune.accuracies[i];
+                tuned_size = size_range[i];
+                tuned_levels = levels_range[levels_idx];
+            }
+        }
+        if (levels_idx == levels_range_length - 1) {
+            for (int i = 0; i < workers * encoded->classes_count; i++) {
+                free_vector(tune.scratch[i]);
+            }
+        }
+        encoded->pool = NULL;
+        free_mlmodel(encoded);
     }
-    // Free allocated memory
-    for (int i = 0; i < model->classes_count; i++) {
-        free_vector(class_vectors[i]);
+    model->size = tuned_size;
+    model->levels = tuned_levels;
+    fit_mlmodel(model, points, num_points, num_features, labels, num_labels, seed);
+    if (best_size) {
+        *best_size = tuned_size;
     }
-    free(class_vectors);
-    free(test_vectors);
-    free(training_vectors);
+    if (best_levels) {
+        *best_levels = tuned_levels;
+    }
+    if (best_accuracy) {
+        *best_accuracy = tuned_accuracy;
+    }
+    pthread_mutex_destroy(&tune.lock);
+    free(tune.scratch);
+    free(tune.prefixes);
+    free(tune.prefix_vectors);
+    free(tune.wrong);
+    free(tune.folds_done);
+    free(tune.abandoned);
+    free(tune.accuracies);
+    folds_free(&folds);
+}
+
+/* Add weight times a level vector rotated by offset to an unpacked buffer */
+static void add_rotated_level(int *dst, Vector *level_vector, int offset, int weight) {
+    int shift = offset % level_vector->size;
+    int tail = level_vector->size - shift;
+    const int *src = level_vector->vector;
+    for (int i = 0; i < shift; i++) {
+        dst[i] += weight * src[tail + i];
+    }
+    for (int i = 0; i < tail; i++) {
+        dst[shift + i] += weight * src[i];
+    }
+}
+
+/* Shallow copy of a vector over other elements, never to be freed */
+static inline Vector vector_over(Vector *vec, int *elements) {
+    Vector over = *vec;
+    over.vector = elements;
+    return over;
+}
+
+/* Shared state of the parallel candidate scoring in stepwise_regression_mlmodel */
+typedef struct StepwiseContext {
+    MLModel *model; // encoded with the currently selected features
+    Folds *folds;
+    int num_features;
+    int *point_levels; // level of every feature of every point, one row per point
+    int *candidates; // features to score, -1 scores the current selection
+    int sign; // -1 to score removing a candidate, 1 to score adding it
+    int *scratch; // per worker class sums, fold prototypes, a point and class level counts
+    size_t scratch_ints; // ints of scratch per worker
+    int *correct; // per candidate
+} StepwiseContext;
+
+/* Write into buffer a point with the contribution of a candidate feature added or removed */
+static void stepwise_point(StepwiseContext *step, int point_idx, int feature, int *buffer) {
+    MLModel *model = step->model;
+    memcpy(buffer, model->point_vectors[point_idx]->vector, model->size * sizeof(int));
+    if (feature >= 0) {
+        int level = step->point_levels[(size_t)point_idx * step->num_features + feature];
+        add_rotated_level(buffer, model->level_vectors[level], feature, step->sign);
+    }
+}
+
+/* Score the candidates in [begin, end) by cross validation */
+static void stepwise_candidate_task(void *context, int begin, int end, int worker) {
+    StepwiseContext *step = (StepwiseContext *)context;
+    MLModel *model = step->model;
+    Folds *folds = step->folds;
+    int classes = model->classes_count;
+    int *sums = step->scratch + step->scratch_ints * worker;
+    int *prototypes = sums + (size_t)classes * model->size;
+    int *point = prototypes + (size_t)classes * model->size;
+    int *level_counts = point + model->size;
+    Vector point_vector = vector_over(model->point_vectors[0], point);
+    Vector *class_vectors[classes];
+    Vector class_views[classes];
+    for (int class_idx = 0; class_idx < classes; class_idx++) {
+        class_views[class_idx] = vector_over(model->class_vectors[class_idx], prototypes + (size_t)class_idx * model->size);
+        class_vectors[class_idx] = &class_views[class_idx];
+    }
+    for (int candidate = begin; candidate < end; candidate++) {
+        int feature = step->candidates[candidate];
+        // Class sums with the candidate, grouping its contribution by class and level
+        for (int class_idx = 0; class_idx < classes; class_idx++) {
+            memcpy(sums + (size_t)class_idx * model->size, model->class_vectors[class_idx]->vector, model->size * sizeof(int));
+        }
+        if (feature >= 0) {
+            memset(level_counts, 0, (size_t)classes * model->levels * sizeof(int));
+            for (int point_idx = 0; point_idx < model->num_points; point_idx++) {
+                int level = step->point_levels[(size_t)point_idx * step->num_features + feature];
+                level_counts[model->point_classes[point_idx] * model->levels + level]++;
+            }
+            for (int class_idx = 0; class_idx < classes; class_idx++) {
+                for (int level = 0; level < model->levels; level++) {
+                    int count = level_counts[class_idx * model->levels + level];
+                    if (count > 0) {
+                        add_rotated_level(sums + (size_t)class_idx * model->size, model->level_vectors[level], feature, step->sign * count);
+                    }
+                }
+            }
+        }
+        // Cross validate with fold subtraction
+        int correct = 0;
+        for (int fold = 0; fold < folds->count; fold++) {
+            memcpy(prototypes, sums, (size_t)classes * model->size * sizeof(int));
+            for (int i = folds->starts[fold]; i < folds->starts[fold + 1]; i++) {
+                int point_idx = folds->points[i];
+                int *prototype = prototypes + (size_t)model->point_classes[point_idx] * model->size;
+                stepwise_point(step, point_idx, feature, point);
+                for (int j = 0; j < model->size; j++) {
+                    prototype[j] -= point[j];
+                }
+            }
+            for (int i = folds->starts[fold]; i < folds->starts[fold + 1]; i++) {
+                int point_idx = folds->points[i];
+                stepwise_point(step, point_idx, feature, point);
+                correct += mlmodel_closest_class(model, &point_vector, class_vectors) == model->point_classes[point_idx];
+            }
+        }
+        step->correct[candidate] = correct;
+    }
+}
+
+/* Add (sign 1) or remove (sign -1) the contribution of a feature to the fitted points and classes */
+static void stepwise_apply(StepwiseContext *step, int feature, int sign) {
+    MLModel *model = step->model;
+    for (int point_idx = 0; point_idx < model->num_points; point_idx++) {
+        int level = step->point_levels[(size_t)point_idx * step->num_features + feature];
+        add_rotated_level(model->point_vectors[point_idx]->vector, model->level_vectors[level], feature, sign);
+        // A feature contribution changes the points, not their number
+        BundleAccumulator *acc = &model->class_accumulators[model->point_classes[point_idx]];
+        int count = acc->count;
+        bundle_accumulator_add_view(acc, vector_view(model->level_vectors[level], feature), sign, 1);
+        acc->count = count;
+    }
+    for (int class_idx = 0; class_idx < model->classes_count; class_idx++) {
+        model->class_dirty[class_idx] = true;
+        mlmodel_class_vector(model, class_idx);
+    }
+    model->selected_features[feature] = sign > 0;
+}
+
+/* Select features by backward elimination or forward selection, scored by cross validation;
+ * the model is left encoded with the selected features */
+void stepwise_regression_mlmodel(MLModel *model, double **points, int num_points, int num_features, char **features, int num_features_list, char **labels, int num_labels, const char *method, int cv, int seed, int *selected, int *num_selected, double *accuracy) {
+    if (!labels) {
+        fprintf(stderr, "Stepwise regression requires class labels\n");
+        exit(EXIT_FAILURE);
+    }
+    if (features && num_features_list != num_features) {
+        fprintf(stderr, "The number of feature names does not match the number of features\n");
+        exit(EXIT_FAILURE);
+    }
+    bool backward;
+    if (strcmp(method, "backward") == 0) {
+        backward = true;
+    } else if (strcmp(method, "forward") == 0) {
+        backward = false;
+    } else {
+        fprintf(stderr, "Stepwise method \"%s\" is not supported\n", method);
+        exit(EXIT_FAILURE);
+    }
+    if (seed == -1) {
+        seed = (int)(rng_entropy_seed() & INT32_MAX);
+    }
+    Folds folds;
+    folds_init(&folds, num_points, cv, seed);
+    // Encode once with all the features
+    fit_mlmodel(model, points, num_points, num_features, labels, num_labels, seed);
+    for (int class_idx = 0; class_idx < model->classes_count; class_idx++) {
+        mlmodel_class_vector(model, class_idx);
+    }
+    check_mlmodel_folds(model, &folds);
+    StepwiseContext step;
+    step.model = model;
+    step.folds = &folds;
+    step.num_features = num_features;
+    step.point_levels = (int *)malloc((size_t)num_points * num_features * sizeof(int));
+    step.candidates = (int *)malloc(num_features * sizeof(int));
+    step.correct = (int *)malloc(num_features * sizeof(int));
+    model->selected_features = (bool *)malloc(num_features * sizeof(bool));
+    ThreadPool *pool = mlmodel_pool(model);
+    step.scratch_ints = (size_t)2 * model->classes_count * model->size + model->size + (size_t)model->classes_count * model->levels;
+    step.scratch = (int *)malloc(step.scratch_ints * thread_pool_size(pool) * sizeof(int));
+    if (!step.point_levels || !step.candidates || !step.correct || !model->selected_features || !step.scratch) {
+        perror("Failed to allocate memory for stepwise regression");
+        exit(EXIT_FAILURE);
+    }
+    for (int point_idx = 0; point_idx < num_points; point_idx++) {
+        for (int feature = 0; feature < num_features; feature++) {
+            step.point_levels[(size_t)point_idx * num_features + feature] = mlmodel_level(model, feature, points[point_idx][feature]);
+        }
+    }
+    int current_correct = 0;
+    if (backward) {
+        // Score the full model, then drop features as long as accuracy does not decrease
+        for (int feature = 0; feature < num_features; feature++) {
+            model->selected_features[feature] = true;
+        }
+        step.candidates[0] = -1;
+        stepwise_candidate_task(&step, 0, 1, 0);
+        current_correct = step.correct[0];
+    } else {
+        // Start from no feature, then add features as long as accuracy increases
+        for (int feature = 0; feature < num_features; feature++) {
+            model->selected_features[feature] = true;
+            stepwise_apply(&step, feature, -1);
+        }
+    }
+    step.sign = backward ? -1 : 1;
+    int remaining = backward ? num_features : 0;
+    while (backward ? remaining > 1 : remaining < num_features) {
+        int num_candidates = 0;
+        for (int feature = 0; feature < num_features; feature++) {
+            if (model->selected_features[feature] == backward) {
+                step.candidates[num_candidates++] = feature;
+            }
+        }
+        parallel_for(pool, num_candidates, 1, stepwise_candidate_task, &step);
+        // Ties keep the lowest feature index
+        int best = 0;
+        for (int candidate = 1; candidate < num_candidates; candidate++) {
+            if (step.correct[candidate] > step.correct[best]) {
+                best = candidate;
+            }
+        }
+        if (backward ? step.correct[best] < current_correct : step.correct[best] <= current_correct) {
+            break;
+        }
+        stepwise_apply(&step, step.candidates[best], step.sign);
+        current_correct = step.correct[best];
+        remaining += backward ? -1 : 1;
+    }
+    int count = 0;
+    for (int feature = 0; feature < num_features; feature++) {
+        if (model->selected_features[feature]) {
+            if (selected) {
+                selected[count] = feature;
+            }
+            count++;
+        }
+    }
+    if (num_selected) {
+        *num_selected = count;
+    }
+    if (accuracy) {
+        *accuracy = (double)current_correct / num_points;
+    }
+    free(step.point_levels);
+    free(step.candidates);
+    free(step.correct);
+    free(step.scratch);
+    folds_free(&folds);
 }
@@ -5,14 +5,61 @@
 #include <string.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Define the random number generator state, as in space.c */
+typedef struct Rng {
+    uint64_t state[4];
+} Rng;
+
+/* Dataset loaded by open_dataset
+ * Values are stored in one row-major matrix: content holds a pointer to each row and
+ * classes a pointer to the label of each sample, as consumed by fit_mlmodel */
+typedef struct Dataset {
+    int num_samples;
+    int num_features;
+    char **samples; // sample ids
+    char **features; // feature names
+    double **content; // row pointers into values
+    double *values; // num_samples rows of num_features values
+    char **classes; // label of each sample, NULL if its line has none
+    int *labels; // index of the label of each sample in class_names, -1 if none
+    char **class_names; // distinct labels in order of first appearance
+    int classes_count;
+    void *mapping; // file holding values and labels when loaded with load_dataset_cache
+    size_t mapping_length;
+} Dataset;
+
+/* Dataset read in batches of rows, see open_dataset_stream */
+typedef struct DatasetStream DatasetStream;
 
 /* Function prototypes */
+Dataset *open_dataset(const char *filepath, const char *sep);
+void set_dataset_threads(int threads);
+void close_dataset(Dataset *dataset);
+DatasetStream *open_dataset_stream(const char *filepath, const char *sep);
+int dataset_stream_num_features(DatasetStream *stream);
+int read_dataset_stream(DatasetStream *stream, double *values, int *labels, int max_rows);
+void rewind_dataset_stream(DatasetStream *stream);
+int dataset_stream_classes_count(DatasetStream *stream);
+const char *dataset_stream_class(DatasetStream *stream, int label);
+void close_dataset_stream(DatasetStream *stream);
 void load_dataset(const char *filepath, const char *sep, char ***samples, char ***features, double ***content, char ***classes, int *num_samples, int *num_features);
 int *percentage_split(char **labels, int num_labels, double percentage, int seed, int *num_selected_indices);
+int *stratified_folds(char **labels, int num_labels, int k, int seed, int *fold_starts);
 
 /* Helper functions */
 void handle_file_not_found(const char *filepath);
 void free_dataset(char **samples, char **features, double **content, char **classes, int num_samples, int num_features);
+void rng_init(Rng *rng, uint64_t seed, uint64_t stream);
+uint64_t rng_next(Rng *rng);
+uint64_t rng_bounded(Rng *rng, uint64_t bound);
 
 int main() {
     /* Example usage of load_dataset */
@@ -71,116 +118,814 @@ int main() {
 
 /* Function implementations */
 
-/* Load the input numerical dataset */
-void load_dataset(const char *filepath, const char *sep, char ***samples, char ***features, double ***content, char ***classes, int *num_samples, int *num_features) {
-    FILE *file = fopen(filepath, "r");
-    if (!file) {
+/* Random number generation, as in space.c
+ * xoshiro256** streams seeded through splitmix64, used to draw reproducible splits. */
+
+/* Advance a splitmix64 state and return its next output */
+static inline uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += UINT64_C(0x9E3779B97F4A7C15));
+    z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+    return z ^ (z >> 31);
+}
+
+/* Initialize the stream identified by (seed, stream) */
+void rng_init(Rng *rng, uint64_t seed, uint64_t stream) {
+    uint64_t key = seed;
+    key = splitmix64(&key) ^ stream;
+    for (int i = 0; i < 4; i++) {
+        rng->state[i] = splitmix64(&key);
+    }
+}
+
+/* Next 64 random bits */
+uint64_t rng_next(Rng *rng) {
+    uint64_t *s = rng->state;
+    uint64_t result = s[1] * 5;
+    result = ((result << 7) | (result >> 57)) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 45) | (s[3] >> 19);
+    return result;
+}
+
+/* Uniform integer in [0, bound) without modulo bias */
+uint64_t rng_bounded(Rng *rng, uint64_t bound) {
+    __uint128_t product = (__uint128_t)rng_next(rng) * bound;
+    uint64_t low = (uint64_t)product;
+    if (low < bound) {
+        uint64_t threshold = -bound % bound;
+        while (low < threshold) {
+            product = (__uint128_t)rng_next(rng) * bound;
+            low = (uint64_t)product;
+        }
+    }
+    return (uint64_t)(product >> 64);
+}
+
+/* Dataset loading
+ * The file is mapped and scanned in place: line ends and field delimiters are found
+ * with memchr, and numbers are converted by a fast exact parser that only falls back
+ * to strtod for the rare inputs it cannot handle. Values go straight into one
+ * row-major matrix sized from the number of lines, and class labels are interned so
+ * that each distinct label is stored once. */
+
+/* Growable block of bytes */
+typedef struct TextBuffer {
+    char *data;
+    size_t length;
+    size_t capacity;
+} TextBuffer;
+
+/* Distinct class labels with an open-addressing table of their indices */
+typedef struct LabelTable {
+    TextBuffer names; // NUL-terminated labels
+    size_t *offsets; // offset of each label in names
+    uint64_t *hashes;
+    int count;
+    int *slots; // label index or -1, capacity is a power of two kept at least twice count
+    int capacity;
+} LabelTable;
+
+/* Mapped text of a dataset and its field delimiters */
+typedef struct DatasetText {
+    const char *data;
+    const char *end;
+    const char *sep;
+    bool delimiters[256];
+    int num_features;
+} DatasetText;
+
+/* Append bytes to a buffer and return the offset they were written at */
+static size_t text_buffer_append(TextBuffer *buffer, const char *data, size_t length) {
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+        while (capacity < buffer->length + length) {
+            capacity *= 2;
+        }
+        buffer->data = (char *)realloc(buffer->data, capacity);
+        if (!buffer->data) {
+            perror("Failed to allocate memory for dataset");
+            exit(EXIT_FAILURE);
+        }
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    size_t offset = buffer->length;
+    buffer->length += length;
+    return offset;
+}
+
+/* Append a field as a NUL-terminated string and return its offset */
+static size_t text_buffer_append_string(TextBuffer *buffer, const char *start, const char *stop) {
+    size_t offset = text_buffer_append(buffer, start, stop - start);
+    text_buffer_append(buffer, "", 1);
+    return offset;
+}
+
+/* Hash a field with 64-bit FNV-1a */
+static uint64_t hash_field(const char *start, const char *stop) {
+    uint64_t hash = UINT64_C(0xCBF29CE484222325);
+    for (const unsigned char *c = (const unsigned char *)start; c < (const unsigned char *)stop; c++) {
+        hash = (hash ^ *c) * UINT64_C(0x100000001B3);
+    }
+    return hash;
+}
+
+/* Get the index of a label, adding it if it is new */
+static int label_table_intern(LabelTable *table, const char *start, const char *stop) {
+    if (2 * (table->count + 1) > table->capacity) {
+        int capacity = table->capacity ? table->capacity * 2 : 64;
+        int *slots = (int *)malloc(capacity * sizeof(int));
+        table->offsets = (size_t *)realloc(table->offsets, capacity * sizeof(size_t));
+        table->hashes = (uint64_t *)realloc(table->hashes, capacity * sizeof(uint64_t));
+        if (!slots || !table->offsets || !table->hashes) {
+            perror("Failed to allocate memory for class labels");
+            exit(EXIT_FAILURE);
+        }
+        memset(slots, -1, capacity * sizeof(int));
+        for (int i = 0; i < table->count; i++) {
+            int slot = (int)(table->hashes[i] & (capacity - 1));
+            while (slots[slot] != -1) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            slots[slot] = i;
+        }
+        free(table->slots);
+        table->slots = slots;
+        table->capacity = capacity;
+    }
+    uint64_t hash = hash_field(start, stop);
+    size_t length = stop - start;
+    int slot = (int)(hash & (table->capacity - 1));
+    while (table->slots[slot] != -1) {
+        int label = table->slots[slot];
+        const char *name = table->names.data + table->offsets[label];
+        if (table->hashes[label] == hash && strncmp(name, start, length) == 0 && name[length] == '\0') {
+            return label;
+        }
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+    int label = table->count++;
+    table->offsets[label] = text_buffer_append_string(&table->names, start, stop);
+    table->hashes[label] = hash;
+    table->slots[slot] = label;
+    return label;
+}
+
+/* Free the storage of a label table */
+static void label_table_free(LabelTable *table) {
+    free(table->names.data);
+    free(table->offsets);
+    free(table->hashes);
+    free(table->slots);
+}
+
+/* Find the end of the line starting at p, before its newline */
+static inline const char *dataset_line_end(const DatasetText *text, const char *p) {
+    const char *newline = (const char *)memchr(p, '\n', text->end - p);
+    return newline ? newline : text->end;
+}
+
+/* Find the next field of a line, skipping runs of delimiters as strtok does */
+static inline bool dataset_next_field(const DatasetText *text, const char **p, const char *line_end, const char **start, const char **stop) {
+    const char *c = *p;
+    while (c < line_end && text->delimiters[(unsigned char)*c]) {
+        c++;
+    }
+    if (c == line_end) {
+        return false;
+    }
+    *start = c;
+    if (text->sep[0] != '\0' && text->sep[1] == '\0') {
+        const char *delimiter = (const char *)memchr(c, text->sep[0], line_end - c);
+        c = delimiter ? delimiter : line_end;
+    } else {
+        while (c < line_end && !text->delimiters[(unsigned char)*c]) {
+            c++;
+        }
+    }
+    *stop = c;
+    *p = c;
+    return true;
+}
+
+/* Exactly representable powers of ten */
+static const double exact_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* Parse a whole field as a number, as strtod would; false if it is not a number
+ * Decimals with at most 19 significant digits whose mantissa fits in a double and
+ * whose power of ten is exact are converted with a single correctly rounded
+ * multiplication or division (Clinger's fast path); anything else goes to strtod */
+static bool parse_number(const char *start, const char *stop, double *value) {
+    const char *c = start;
+    bool negative = false;
+    if (c < stop && (*c == '+' || *c == '-')) {
+        negative = *c++ == '-';
+    }
+    uint64_t mantissa = 0;
+    int significant = 0;
+    int exponent = 0;
+    bool digits = false;
+    while (c < stop && *c >= '0' && *c <= '9') {
+        mantissa = mantissa * 10 + (uint64_t)(*c++ - '0');
+        significant += mantissa > 0;
+        digits = true;
+    }
+    if (c < stop && *c == '.') {
+        c++;
+        while (c < stop && *c >= '0' && *c <= '9') {
+            mantissa = mantissa * 10 + (uint64_t)(*c++ - '0');
+            significant += mantissa > 0;
+            exponent--;
+            digits = true;
+        }
+    }
+    if (digits && c < stop && (*c == 'e' || *c == 'E')) {
+        const char *e = c + 1;
+        bool negative_exponent = false;
+        if (e < stop && (*e == '+' || *e == '-')) {
+            negative_exponent = *e++ == '-';
+        }
+        int power = 0;
+        bool power_digits = false;
+        while (e < stop && *e >= '0' && *e <= '9') {
+            power = power < 10000 ? power * 10 + (*e - '0') : power;
+            e++;
+            power_digits = true;
+        }
+        if (power_digits) {
+            exponent += negative_exponent ? -power : power;
+            c = e;
+        }
+    }
+    if (digits && c == stop && significant <= 19 && mantissa <= (UINT64_C(1) << 53) && exponent >= -22 && exponent <= 22) {
+        double result = (double)mantissa;
+        result = exponent < 0 ? result / exact_powers_of_ten[-exponent] : result * exact_powers_of_ten[exponent];
+        *value = negative ? -result : result;
+        return true;
+    }
+
+    /* Slow path: long mantissas, large exponents, hexadecimal, inf and nan */
+    char buffer[64];
+    size_t length = stop - start;
+    char *copy = length < sizeof(buffer) ? buffer : (char *)malloc(length + 1);
+    if (!copy) {
+        perror("Failed to allocate memory for dataset");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(copy, start, length);
+    copy[length] = '\0';
+    char *endptr;
+    *value = strtod(copy, &endptr);
+    bool parsed = length > 0 && *endptr == '\0';
+    if (copy != buffer) {
+        free(copy);
+    }
+    return parsed;
+}
+
+/* Map a dataset file for sequential reading; NULL data for an empty file */
+static void map_dataset(const char *filepath, DatasetText *text, size_t *length) {
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0) {
         handle_file_not_found(filepath);
         exit(EXIT_FAILURE);
     }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror("Failed to stat dataset");
+        exit(EXIT_FAILURE);
+    }
+    *length = st.st_size;
+    text->data = NULL;
+    if (*length > 0) {
+        void *mapping = mmap(NULL, *length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            perror("Failed to map dataset");
+            exit(EXIT_FAILURE);
+        }
+        madvise(mapping, *length, MADV_SEQUENTIAL);
+        text->data = (const char *)mapping;
+    }
+    close(fd);
+    text->end = text->data + *length;
+}
 
-    char line[1024];
-    char *token;
-    int line_num = 0;
-    *num_samples = 0;
-    *num_features = 0;
-    int content_capacity = 10;
-    int features_capacity = 10;
+/* Minimum size of the chunks parsed in parallel */
+#define DATASET_CHUNK_BYTES (1 << 20)
 
-    /* Initialize arrays */
-    *samples = NULL;
-    *features = NULL;
-    *content = NULL;
-    *classes = NULL;
+/* Outcomes of parsing a line other than a sample */
+#define DATASET_SKIPPED -1
+#define DATASET_ERROR_NUMBER 1
+#define DATASET_ERROR_FEATURES 2
 
-    /* Read the first line (features) */
-    if (fgets(line, sizeof(line), file)) {
-        line[strcspn(line, "\r\n")] = '\0'; // Remove newline characters
-        char *line_copy = strdup(line);
-        char *rest = line_copy;
-
-        /* Skip the first column (Sample ID) */
-        token = strtok_r(rest, sep, &rest);
-
-        /* Read feature names */
-        *features = (char **)malloc(features_capacity * sizeof(char *));
-        int feature_idx = 0;
-        while ((token = strtok_r(NULL, sep, &rest))) {
-            if (strcmp(token, "") == 0) {
-                continue;
-            }
-            if (strcmp(token, "#") == 0) {
-                break;
-            }
-            if (feature_idx >= features_capacity) {
-                features_capacity *= 2;
-                *features = (char **)realloc(*features, features_capacity * sizeof(char *));
+/* Sample id and class label of a parsed line, label_start is NULL if it has none */
+typedef struct DatasetFields {
+    const char *id_start;
+    const char *id_stop;
+    const char *label_start;
+    const char *label_stop;
+} DatasetFields;
+
+/* Parse a line without its newline into a row of values
+ * Returns 0 for a sample, DATASET_SKIPPED for a comment or an empty line, or the error */
+static int parse_dataset_line(const DatasetText *text, const char *line, const char *line_end, double *row, DatasetFields *fields) {
+    const char *p = line;
+    const char *start;
+    const char *stop;
+    if (line == line_end || *line == '#' || !dataset_next_field(text, &p, line_end, &start, &stop)) {
+        return DATASET_SKIPPED;
+    }
+
+    /* Read Sample ID */
+    fields->id_start = start;
+    fields->id_stop = stop;
+
+    /* Read numerical data, then the class label */
+    int feature_idx = 0;
+    fields->label_start = NULL;
+    fields->label_stop = NULL;
+    while (dataset_next_field(text, &p, line_end, &start, &stop)) {
+        if (feature_idx < text->num_features) {
+            if (!parse_number(start, stop, &row[feature_idx++])) {
+                return DATASET_ERROR_NUMBER;
             }
-            (*features)[feature_idx++] = strdup(token);
+        } else {
+            fields->label_start = start;
+            fields->label_stop = stop;
+            break;
         }
-        *num_features = feature_idx;
-        free(line_copy);
+    }
+    return feature_idx == text->num_features ? 0 : DATASET_ERROR_FEATURES;
+}
+
+/* Report a parsing error and exit */
+static void dataset_error(int error, int line_num) {
+    if (error == DATASET_ERROR_NUMBER) {
+        fprintf(stderr, "The input dataset must contain numbers only! Error at line %d\n", line_num);
     } else {
-        fprintf(stderr, "Empty file or unable to read the file: %s\n", filepath);
-        fclose(file);
+        fprintf(stderr, "Mismatch in the number of features at line %d\n", line_num);
+    }
+    exit(EXIT_FAILURE);
+}
+
+/* Lines of a dataset parsed by one thread, into its own rows of the matrix */
+typedef struct DatasetChunk {
+    const char *begin;
+    const char *end;
+    int lines;
+    int first_line; // number of the first line, the header being line 0
+    int first_row; // first matrix row reserved for the chunk, one per line
+    int num_samples;
+    TextBuffer sample_names;
+    LabelTable label_table; // labels are indices in this table until stitched
+    int error; // 0 or DATASET_ERROR_*, for the first bad line of the chunk
+    int error_line;
+} DatasetChunk;
+
+/* Shared state of a parallel load */
+typedef struct DatasetJob {
+    const DatasetText *text;
+    DatasetChunk *chunks;
+    int chunks_count;
+    double *values;
+    int *labels;
+    size_t *sample_offsets; // offset of each sample id in the names of its chunk
+    void (*task)(struct DatasetJob *job, DatasetChunk *chunk);
+    _Atomic int next_chunk;
+} DatasetJob;
+
+/* Number of threads used by open_dataset, 0 for one per online CPU */
+static int dataset_threads = 0;
+
+/* Set the number of threads used by open_dataset and load_dataset */
+void set_dataset_threads(int threads) {
+    dataset_threads = threads > 0 ? threads : 0;
+}
+
+/* Get the index of a NUL-terminated label, adding it if it is new */
+static int label_table_intern_string(LabelTable *table, const char *name) {
+    return label_table_intern(table, name, name + strlen(name));
+}
+
+/* Split the text from begin into chunks that end right after a newline */
+static void dataset_split(DatasetJob *job, const char *begin) {
+    const DatasetText *text = job->text;
+    int threads = dataset_threads > 0 ? dataset_threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    size_t bytes = text->end - begin;
+    /* A few chunks per thread even out lines of uneven cost */
+    size_t count = bytes / DATASET_CHUNK_BYTES + 1;
+    if (count > (size_t)(threads > 1 ? 4 * threads : 1)) {
+        count = threads > 1 ? 4 * threads : 1;
+    }
+    job->chunks = (DatasetChunk *)calloc(count, sizeof(DatasetChunk));
+    if (!job->chunks) {
+        perror("Failed to allocate memory for dataset");
         exit(EXIT_FAILURE);
     }
+    const char *chunk_begin = begin;
+    for (size_t c = 0; c < count; c++) {
+        const char *chunk_end = text->end;
+        if (c + 1 < count) {
+            chunk_end = begin + bytes / count * (c + 1);
+            chunk_end = chunk_end < chunk_begin ? chunk_begin : chunk_end;
+            const char *newline = (const char *)memchr(chunk_end, '\n', text->end - chunk_end);
+            chunk_end = newline ? newline + 1 : text->end;
+        }
+        job->chunks[c].begin = chunk_begin;
+        job->chunks[c].end = chunk_end;
+        chunk_begin = chunk_end;
+    }
+    job->chunks_count = (int)count;
+}
+
+/* Count the lines of a chunk */
+static void count_dataset_chunk(DatasetJob *job, DatasetChunk *chunk) {
+    (void)job;
+    int lines = 0;
+    for (const char *c = chunk->begin; c < chunk->end; lines++) {
+        const char *newline = (const char *)memchr(c, '\n', chunk->end - c);
+        c = newline ? newline + 1 : chunk->end;
+    }
+    chunk->lines = lines;
+}
 
-    /* Read the rest of the file */
-    while (fgets(line, sizeof(line), file)) {
+/* Parse the samples of a chunk into its rows, stopping at the first bad line */
+static void parse_dataset_chunk(DatasetJob *job, DatasetChunk *chunk) {
+    const DatasetText *text = job->text;
+    int num_features = text->num_features;
+    int line_num = chunk->first_line - 1;
+    const char *next_line;
+    for (const char *line = chunk->begin; line < chunk->end; line = next_line) {
         line_num++;
-        line[strcspn(line, "\r\n")] = '\0'; // Remove newline characters
-        if (line[0] == '#' || strlen(line) == 0) {
+        const char *line_end = dataset_line_end(text, line);
+        next_line = line_end < text->end ? line_end + 1 : text->end;
+        if (line_end > line && line_end[-1] == '\r') {
+            line_end--;
+        }
+        int row_idx = chunk->first_row + chunk->num_samples;
+        DatasetFields fields;
+        int status = parse_dataset_line(text, line, line_end, job->values + (size_t)row_idx * num_features, &fields);
+        if (status == DATASET_SKIPPED) {
             continue;
         }
-        char *line_copy = strdup(line);
-        char *rest = line_copy;
-
-        /* Allocate memory for samples and classes */
-        *samples = (char **)realloc(*samples, (*num_samples + 1) * sizeof(char *));
-        *classes = (char **)realloc(*classes, (*num_samples + 1) * sizeof(char *));
-
-        /* Read Sample ID */
-        token = strtok_r(rest, sep, &rest);
-        (*samples)[*num_samples] = strdup(token);
-
-        /* Allocate memory for content row */
-        if (*content == NULL) {
-            *content = (double **)malloc(content_capacity * sizeof(double *));
-        }
-        if (*num_samples >= content_capacity) {
-            content_capacity *= 2;
-            *content = (double **)realloc(*content, content_capacity * sizeof(double *));
-        }
-        (*content)[*num_samples] = (double *)malloc(*num_features * sizeof(double));
-
-        /* Read numerical data */
-        int feature_idx = 0;
-        while ((token = strtok_r(NULL, sep, &rest))) {
-            if (feature_idx < *num_features) {
-                char *endptr;
-                double value = strtod(token, &endptr);
-                if (*endptr != '\0') {
-                    fprintf(stderr, "The input dataset must contain numbers only! Error at line %d\n", line_num);
-                    fclose(file);
-                    exit(EXIT_FAILURE);
-                }
-                (*content)[*num_samples][feature_idx++] = value;
-            } else {
-                /* Read Class label */
-                (*classes)[*num_samples] = strdup(token);
-                break;
+        if (status != 0) {
+            chunk->error = status;
+            chunk->error_line = line_num;
+            return;
+        }
+        job->sample_offsets[row_idx] = text_buffer_append_string(&chunk->sample_names, fields.id_start, fields.id_stop);
+        job->labels[row_idx] = fields.label_start ? label_table_intern(&chunk->label_table, fields.label_start, fields.label_stop) : -1;
+        chunk->num_samples++;
+    }
+}
+
+/* Run the task of a job on chunks until none is left */
+static void *dataset_worker_run(void *arg) {
+    DatasetJob *job = (DatasetJob *)arg;
+    int c;
+    while ((c = atomic_fetch_add(&job->next_chunk, 1)) < job->chunks_count) {
+        job->task(job, &job->chunks[c]);
+    }
+    return NULL;
+}
+
+/* Run a task on every chunk of a job, in parallel */
+static void run_dataset_job(DatasetJob *job, void (*task)(DatasetJob *job, DatasetChunk *chunk)) {
+    job->task = task;
+    atomic_init(&job->next_chunk, 0);
+    int threads = dataset_threads > 0 ? dataset_threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > job->chunks_count) {
+        threads = job->chunks_count;
+    }
+    pthread_t *workers = (pthread_t *)malloc((threads > 1 ? threads : 1) * sizeof(pthread_t));
+    if (!workers) {
+        perror("Failed to allocate memory for dataset");
+        exit(EXIT_FAILURE);
+    }
+    for (int t = 1; t < threads; t++) {
+        if (pthread_create(&workers[t], NULL, dataset_worker_run, job) != 0) {
+            perror("Failed to start dataset thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    dataset_worker_run(job);
+    for (int t = 1; t < threads; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    free(workers);
+}
+
+/* Map a dataset and read its header: the feature names are appended to names, with
+ * their offsets in a new array. Returns the first line after the header */
+static const char *open_dataset_text(const char *filepath, const char *sep, DatasetText *text, size_t *length, TextBuffer *names, size_t **offsets) {
+    map_dataset(filepath, text, length);
+    if (*length == 0) {
+        fprintf(stderr, "Empty file or unable to read the file: %s\n", filepath);
+        exit(EXIT_FAILURE);
+    }
+    text->sep = sep;
+    memset(text->delimiters, 0, sizeof(text->delimiters));
+    for (const unsigned char *c = (const unsigned char *)sep; *c; c++) {
+        text->delimiters[*c] = true;
+    }
+
+    /* Read the first line (features) */
+    const char *line = text->data;
+    const char *line_end = dataset_line_end(text, line);
+    const char *next_line = line_end < text->end ? line_end + 1 : text->end;
+    if (line_end > line && line_end[-1] == '\r') {
+        line_end--;
+    }
+    int features_capacity = 0;
+    int num_features = 0;
+    const char *start;
+    const char *stop;
+    const char *p = line;
+    *offsets = NULL;
+    /* Skip the first column (Sample ID) */
+    dataset_next_field(text, &p, line_end, &start, &stop);
+    while (dataset_next_field(text, &p, line_end, &start, &stop)) {
+        if (stop - start == 1 && *start == '#') {
+            break;
+        }
+        if (num_features == features_capacity) {
+            features_capacity = features_capacity ? features_capacity * 2 : 64;
+            *offsets = (size_t *)realloc(*offsets, features_capacity * sizeof(size_t));
+            if (!*offsets) {
+                perror("Failed to allocate memory for features");
+                exit(EXIT_FAILURE);
             }
         }
-        if (feature_idx != *num_features) {
-            fprintf(stderr, "Mismatch in the number of features at line %d\n", line_num);
-            fclose(file);
+        (*offsets)[num_features++] = text_buffer_append_string(names, start, stop);
+    }
+    text->num_features = num_features;
+    return next_line;
+}
+
+/* Load a dataset: the first line holds a sample id column and the feature names, up to
+ * a "#" field; each following line holds a sample id, its values and its class label.
+ * Lines starting with '#' and empty lines are skipped. sep lists the delimiter
+ * characters, and runs of delimiters count as one */
+Dataset *open_dataset(const char *filepath, const char *sep) {
+    DatasetText text;
+    size_t length;
+    TextBuffer feature_names = {0};
+    size_t *feature_offsets = NULL;
+    const char *next_line = open_dataset_text(filepath, sep, &text, &length, &feature_names, &feature_offsets);
+    int num_features = text.num_features;
+
+    /* Split the rest of the file at line boundaries and count the lines of each chunk */
+    DatasetJob job;
+    memset(&job, 0, sizeof(job));
+    job.text = &text;
+    dataset_split(&job, next_line);
+    run_dataset_job(&job, count_dataset_chunk);
+    int max_samples = 0;
+    for (int c = 0; c < job.chunks_count; c++) {
+        job.chunks[c].first_line = max_samples + 1;
+        job.chunks[c].first_row = max_samples;
+        max_samples += job.chunks[c].lines;
+    }
+
+    /* Every line holds at most one sample: chunks parse into disjoint row ranges */
+    Dataset *dataset = (Dataset *)calloc(1, sizeof(Dataset));
+    size_t rows_bytes = (size_t)max_samples * sizeof(double *);
+    char *content_block = (char *)malloc(rows_bytes + (size_t)max_samples * num_features * sizeof(double) + 1);
+    job.labels = (int *)malloc(((size_t)max_samples + 1) * sizeof(int));
+    job.sample_offsets = (size_t *)malloc(((size_t)max_samples + 1) * sizeof(size_t));
+    if (!dataset || !content_block || !job.labels || !job.sample_offsets) {
+        perror("Failed to allocate memory for dataset");
+        exit(EXIT_FAILURE);
+    }
+    job.values = (double *)(content_block + rows_bytes);
+    run_dataset_job(&job, parse_dataset_chunk);
+    munmap((void *)text.data, length);
+    for (int c = 0; c < job.chunks_count; c++) {
+        if (job.chunks[c].error) {
+            dataset_error(job.chunks[c].error, job.chunks[c].error_line);
+        }
+    }
+
+    /* Stitch the chunks in file order: close the gaps left by skipped lines, and
+     * translate sample names and labels into the dataset-wide tables */
+    int num_samples = 0;
+    size_t sample_names_length = 0;
+    LabelTable label_table = {0};
+    for (int c = 0; c < job.chunks_count; c++) {
+        DatasetChunk *chunk = &job.chunks[c];
+        if (chunk->first_row != num_samples && chunk->num_samples > 0) {
+            memmove(job.values + (size_t)num_samples * num_features, job.values + (size_t)chunk->first_row * num_features, (size_t)chunk->num_samples * num_features * sizeof(double));
+            memmove(job.labels + num_samples, job.labels + chunk->first_row, chunk->num_samples * sizeof(int));
+            memmove(job.sample_offsets + num_samples, job.sample_offsets + chunk->first_row, chunk->num_samples * sizeof(size_t));
+        }
+        int *label_map = (int *)malloc((chunk->label_table.count + 1) * sizeof(int));
+        if (!label_map) {
+            perror("Failed to allocate memory for class labels");
             exit(EXIT_FAILURE);
         }
-        (*num_samples)++;
-        free(line_copy);
+        for (int i = 0; i < chunk->label_table.count; i++) {
+            label_map[i] = label_table_intern_string(&label_table, chunk->label_table.names.data + chunk->label_table.offsets[i]);
+        }
+        for (int i = num_samples; i < num_samples + chunk->num_samples; i++) {
+            job.sample_offsets[i] += sample_names_length;
+            job.labels[i] = job.labels[i] >= 0 ? label_map[job.labels[i]] : -1;
+        }
+        free(label_map);
+        num_samples += chunk->num_samples;
+        sample_names_length += chunk->sample_names.length;
+    }
+
+    /* Each array owns the strings it points to, in the same allocation */
+    dataset->num_samples = num_samples;
+    dataset->num_features = num_features;
+    dataset->values = job.values;
+    dataset->content = (double **)content_block;
+    for (int i = 0; i < num_samples; i++) {
+        dataset->content[i] = job.values + (size_t)i * num_features;
+    }
+    dataset->features = (char **)malloc(num_features * sizeof(char *) + feature_names.length + 1);
+    dataset->samples = (char **)malloc(num_samples * sizeof(char *) + sample_names_length + 1);
+    dataset->classes = (char **)malloc(num_samples * sizeof(char *) + label_table.names.length + 1);
+    dataset->class_names = (char **)malloc((label_table.count + 1) * sizeof(char *));
+    if (!dataset->features || !dataset->samples || !dataset->classes || !dataset->class_names) {
+        perror("Failed to allocate memory for dataset");
+        exit(EXIT_FAILURE);
+    }
+    char *strings = (char *)(dataset->features + num_features);
+    if (feature_names.length > 0) {
+        memcpy(strings, feature_names.data, feature_names.length);
+    }
+    for (int i = 0; i < num_features; i++) {
+        dataset->features[i] = strings + feature_offsets[i];
+    }
+    strings = (char *)(dataset->samples + num_samples);
+    for (int c = 0; c < job.chunks_count; c++) {
+        if (job.chunks[c].sample_names.length > 0) {
+            memcpy(strings, job.chunks[c].sample_names.data, job.chunks[c].sample_names.length);
+            strings += job.chunks[c].sample_names.length;
+        }
+    }
+    strings = (char *)(dataset->samples + num_samples);
+    for (int i = 0; i < num_samples; i++) {
+        dataset->samples[i] = strings + job.sample_offsets[i];
+    }
+    strings = (char *)(dataset->classes + num_samples);
+    if (label_table.names.length > 0) {
+        memcpy(strings, label_table.names.data, label_table.names.length);
+    }
+    for (int i = 0; i < label_table.count; i++) {
+        dataset->class_names[i] = strings + label_table.offsets[i];
+    }
+    for (int i = 0; i < num_samples; i++) {
+        dataset->classes[i] = job.labels[i] >= 0 ? dataset->class_names[job.labels[i]] : NULL;
+    }
+    dataset->labels = job.labels;
+    dataset->classes_count = label_table.count;
+
+    for (int c = 0; c < job.chunks_count; c++) {
+        free(job.chunks[c].sample_names.data);
+        label_table_free(&job.chunks[c].label_table);
+    }
+    free(job.chunks);
+    free(job.sample_offsets);
+    free(feature_names.data);
+    free(feature_offsets);
+    label_table_free(&label_table);
+    return dataset;
+}
+
+/* Free a dataset loaded with open_dataset or load_dataset_cache */
+void close_dataset(Dataset *dataset) {
+    if (dataset) {
+        free_dataset(dataset->samples, dataset->features, dataset->content, dataset->classes, dataset->num_samples, dataset->num_features);
+        if (dataset->mapping) {
+            munmap(dataset->mapping, dataset->mapping_length);
+        } else {
+            free(dataset->labels);
+        }
+        free(dataset->class_names);
+        free(dataset);
     }
-    fclose(file);
+}
+
+/* Streaming
+ * A stream parses the mapped file one batch of rows at a time into buffers owned by
+ * the caller, so memory does not grow with the dataset. Pages behind the last line
+ * read are released from the mapping as the stream moves on. */
+
+struct DatasetStream {
+    DatasetText text;
+    size_t length;
+    const char *first_line; // first line after the header
+    const char *next_line;
+    const char *released; // pages before this address have been released
+    int line_num;
+    LabelTable label_table; // labels in order of first appearance, kept across rewinds
+};
+
+/* Open a dataset, in the format read by open_dataset, for reading in batches */
+DatasetStream *open_dataset_stream(const char *filepath, const char *sep) {
+    DatasetStream *stream = (DatasetStream *)calloc(1, sizeof(DatasetStream));
+    if (!stream) {
+        perror("Failed to allocate memory for dataset stream");
+        exit(EXIT_FAILURE);
+    }
+    TextBuffer feature_names = {0};
+    size_t *feature_offsets = NULL;
+    stream->first_line = open_dataset_text(filepath, sep, &stream->text, &stream->length, &feature_names, &feature_offsets);
+    free(feature_names.data);
+    free(feature_offsets);
+    rewind_dataset_stream(stream);
+    return stream;
+}
+
+/* Get the number of features of the rows of a stream */
+int dataset_stream_num_features(DatasetStream *stream) {
+    return stream->text.num_features;
+}
+
+/* Read up to max_rows samples into values (max_rows rows of num_features values) and
+ * their label indices (-1 for a line without a label); returns the number of rows
+ * read, 0 at the end of the file */
+int read_dataset_stream(DatasetStream *stream, double *values, int *labels, int max_rows) {
+    const DatasetText *text = &stream->text;
+    int rows = 0;
+    while (rows < max_rows && stream->next_line < text->end) {
+        const char *line = stream->next_line;
+        const char *line_end = dataset_line_end(text, line);
+        stream->next_line = line_end < text->end ? line_end + 1 : text->end;
+        stream->line_num++;
+        if (line_end > line && line_end[-1] == '\r') {
+            line_end--;
+        }
+        DatasetFields fields;
+        int status = parse_dataset_line(text, line, line_end, values + (size_t)rows * text->num_features, &fields);
+        if (status == DATASET_SKIPPED) {
+            continue;
+        }
+        if (status != 0) {
+            dataset_error(status, stream->line_num);
+        }
+        labels[rows++] = fields.label_start ? label_table_intern(&stream->label_table, fields.label_start, fields.label_stop) : -1;
+    }
+
+    /* Release the whole pages that were read */
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    const char *boundary = (const char *)((uintptr_t)stream->next_line & ~(page - 1));
+    if (boundary > stream->released) {
+        madvise((void *)stream->released, boundary - stream->released, MADV_DONTNEED);
+        stream->released = boundary;
+    }
+    return rows;
+}
+
+/* Go back to the first row of a stream */
+void rewind_dataset_stream(DatasetStream *stream) {
+    stream->next_line = stream->first_line;
+    stream->released = stream->text.data;
+    stream->line_num = 0;
+}
+
+/* Get the number of distinct labels read so far */
+int dataset_stream_classes_count(DatasetStream *stream) {
+    return stream->label_table.count;
+}
+
+/* Get a label by the index returned by read_dataset_stream */
+const char *dataset_stream_class(DatasetStream *stream, int label) {
+    return stream->label_table.names.data + stream->label_table.offsets[label];
+}
+
+/* Close a dataset stream */
+void close_dataset_stream(DatasetStream *stream) {
+    if (stream) {
+        munmap((void *)stream->text.data, stream->length);
+        label_table_free(&stream->label_table);
+        free(stream);
+    }
+}
+
+/* Load the input numerical dataset */
+void load_dataset(const char *filepath, const char *sep, char ***samples, char ***features, double ***content, char ***classes, int *num_samples, int *num_features) {
+    Dataset *dataset = open_dataset(filepath, sep);
+    *samples = dataset->samples;
+    *features = dataset->features;
+    *content = dataset->content;
+    *classes = dataset->classes;
+    *num_samples = dataset->num_samples;
+    *num_features = dataset->num_features;
+    free(dataset->labels);
+    free(dataset->class_names);
+    free(dataset);
 }
 
 /* Handle file not found error */
@@ -188,23 +933,85 @@ void handle_file_not_found(const char *filepath) {
     fprintf(stderr, "File not found: %s\n", filepath);
 }
 
-/* Free the allocated memory for the dataset */
+/* Free the allocated memory for the dataset
+ * Each array is a single allocation that also holds its rows or strings */
 void free_dataset(char **samples, char **features, double **content, char **classes, int num_samples, int num_features) {
-    for (int i = 0; i < num_samples; i++) {
-        free(samples[i]);
-        free(content[i]);
-        free(classes[i]);
-    }
+    (void)num_samples;
+    (void)num_features;
     free(samples);
     free(classes);
     free(content);
-    for (int i = 0; i < num_features; i++) {
-        free(features[i]);
-    }
     free(features);
 }
 
-/* Given list of classes and a percentage, split the dataset and return indices of selected data points */
+/* Samples grouped by class: the samples of group g are members[starts[g]] to
+ * members[starts[g + 1] - 1], in increasing order. Groups are the classes in order of
+ * first appearance, followed by a last group for the unlabeled samples */
+typedef struct LabelGroups {
+    int count; // classes_count + 1
+    int classes_count;
+    int *starts;
+    int *members;
+} LabelGroups;
+
+/* Group samples by class label with a hash table of the labels and a counting sort */
+static void label_groups_init(LabelGroups *groups, char **labels, int num_labels) {
+    LabelTable label_table = {0};
+    int *group_of = (int *)malloc((num_labels + 1) * sizeof(int));
+    if (!group_of) {
+        perror("Failed to allocate memory for class labels");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_labels; i++) {
+        group_of[i] = labels[i] ? label_table_intern_string(&label_table, labels[i]) : -1;
+    }
+    groups->classes_count = label_table.count;
+    groups->count = label_table.count + 1;
+    label_table_free(&label_table);
+    groups->starts = (int *)calloc(groups->count + 1, sizeof(int));
+    groups->members = (int *)malloc((num_labels + 1) * sizeof(int));
+    if (!groups->starts || !groups->members) {
+        perror("Failed to allocate memory for class labels");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_labels; i++) {
+        if (group_of[i] < 0) {
+            group_of[i] = groups->classes_count;
+        }
+        groups->starts[group_of[i] + 1]++;
+    }
+    for (int g = 0; g < groups->count; g++) {
+        groups->starts[g + 1] += groups->starts[g];
+    }
+    /* Reuse the counts as fill positions, then shift them back into starts */
+    for (int i = 0; i < num_labels; i++) {
+        groups->members[groups->starts[group_of[i]]++] = i;
+    }
+    for (int g = groups->count; g > 0; g--) {
+        groups->starts[g] = groups->starts[g - 1];
+    }
+    groups->starts[0] = 0;
+    free(group_of);
+}
+
+static void label_groups_free(LabelGroups *groups) {
+    free(groups->starts);
+    free(groups->members);
+}
+
+/* Move a uniform random choice of count members of a group to its front (partial Fisher-Yates shuffle) */
+static void label_group_shuffle(Rng *rng, int *members, int size, int count) {
+    for (int i = 0; i < count; i++) {
+        int j = i + (int)rng_bounded(rng, (uint64_t)(size - i));
+        int temp = members[i];
+        members[i] = members[j];
+        members[j] = temp;
+    }
+}
+
+/* Given list of classes and a percentage, split the dataset and return indices of selected data points.
+ * The percentage of each class, rounded down, is drawn without replacement, and the indices are
+ * returned in increasing order; unlabeled samples are split as a class of their own */
 int *percentage_split(char **labels, int num_labels, double percentage, int seed, int *num_selected_indices) {
     if (percentage <= 0.0 || percentage > 100.0) {
         fprintf(stderr, "Percentage must be greater than 0 and lower than or equal to 100\n");
@@ -216,96 +1023,107 @@ int *percentage_split(char **labels, int num_labels, double percentage, int seed
         exit(EXIT_FAILURE);
     }
 
-    /* Find unique labels */
-    char **unique_labels = (char **)malloc(num_labels * sizeof(char *));
-    int unique_count = 0;
-    for (int i = 0; i < num_labels; i++) {
-        bool exists = false;
-        for (int j = 0; j < unique_count; j++) {
-            if (strcmp(labels[i], unique_labels[j]) == 0) {
-                exists = true;
-                break;
-            }
-        }
-        if (!exists) {
-            unique_labels[unique_count++] = labels[i];
-        }
-    }
-
-    if (unique_count < 2) {
+    LabelGroups groups;
+    label_groups_init(&groups, labels, num_labels);
+    if (groups.classes_count < 2) {
         fprintf(stderr, "The list of class labels must contain at least two unique labels\n");
-        free(unique_labels);
+        label_groups_free(&groups);
         exit(EXIT_FAILURE);
     }
 
     /* Initialize random number generator */
-    srand(seed);
+    Rng rng;
+    rng_init(&rng, (uint64_t)seed, 0);
 
-    /* Selection array */
-    int *selection = NULL;
-    int selection_capacity = 10;
+    /* Mark the selected samples, then collect them in order */
+    bool *selected = (bool *)calloc(num_labels + 1, sizeof(bool));
+    if (!selected) {
+        perror("Failed to allocate memory for selection");
+        exit(EXIT_FAILURE);
+    }
     int selection_count = 0;
-    selection = (int *)malloc(selection_capacity * sizeof(int));
-
-    for (int i = 0; i < unique_count; i++) {
-        char *label = unique_labels[i];
-
-        /* Count occurrences of the label */
-        int label_count = 0;
-        for (int j = 0; j < num_labels; j++) {
-            if (strcmp(labels[j], label) == 0) {
-                label_count++;
-            }
-        }
-
-        /* Calculate number of points to select */
+    for (int g = 0; g < groups.count; g++) {
+        int *members = groups.members + groups.starts[g];
+        int label_count = groups.starts[g + 1] - groups.starts[g];
         int select_points = (int)(percentage * label_count / 100.0);
-
-        /* Collect indices of samples with the current label */
-        int *indices = (int *)malloc(label_count * sizeof(int));
-        int idx = 0;
-        for (int j = 0; j < num_labels; j++) {
-            if (strcmp(labels[j], label) == 0) {
-                indices[idx++] = j;
-            }
-        }
-
-        /* Randomly select indices */
+        label_group_shuffle(&rng, members, label_count, select_points);
         for (int k = 0; k < select_points; k++) {
-            int rand_idx = rand() % label_count;
-            int selected_idx = indices[rand_idx];
-
-            /* Check if already selected */
-            bool already_selected = false;
-            for (int m = 0; m < selection_count; m++) {
-                if (selection[m] == selected_idx) {
-                    already_selected = true;
-                    break;
-                }
-            }
-            if (!already_selected) {
-                if (selection_count >= selection_capacity) {
-                    selection_capacity *= 2;
-                    selection = (int *)realloc(selection, selection_capacity * sizeof(int));
-                }
-                selection[selection_count++] = selected_idx;
-            }
+            selected[members[k]] = true;
         }
-        free(indices);
+        selection_count += select_points;
     }
-    free(unique_labels);
+    label_groups_free(&groups);
 
-    /* Sort the selection */
-    for (int i = 0; i < selection_count - 1; i++) {
-        for (int j = i + 1; j < selection_count; j++) {
-            if (selection[i] > selection[j]) {
-                int temp = selection[i];
-                selection[i] = selection[j];
-                selection[j] = temp;
-            }
+    int *selection = (int *)malloc((selection_count + 1) * sizeof(int));
+    if (!selection) {
+        perror("Failed to allocate memory for selection");
+        exit(EXIT_FAILURE);
+    }
+    int idx = 0;
+    for (int i = 0; i < num_labels; i++) {
+        if (selected[i]) {
+            selection[idx++] = i;
         }
     }
+    free(selected);
 
     *num_selected_indices = selection_count;
     return selection;
 }
+
+/* Split the samples into k stratified folds: each class is shuffled and dealt to the folds in
+ * turn, so every fold holds the same share of each class, and fold sizes differ by at most one.
+ * Returns the indices of all the samples grouped by fold, those of fold f being at positions
+ * fold_starts[f] to fold_starts[f + 1] - 1 in increasing order; fold_starts holds k + 1 entries */
+int *stratified_folds(char **labels, int num_labels, int k, int seed, int *fold_starts) {
+    if (k < 2 || k > num_labels) {
+        fprintf(stderr, "The number of folds must be between 2 and the number of data points\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (seed < 0) {
+        fprintf(stderr, "The input seed must be a non-negative integer number\n");
+        exit(EXIT_FAILURE);
+    }
+
+    LabelGroups groups;
+    label_groups_init(&groups, labels, num_labels);
+
+    Rng rng;
+    rng_init(&rng, (uint64_t)seed, 0);
+
+    /* Deal the shuffled members of each class, continuing from the fold the previous class stopped at */
+    int *fold_of = (int *)malloc((num_labels + 1) * sizeof(int));
+    int *folds = (int *)malloc((num_labels + 1) * sizeof(int));
+    if (!fold_of || !folds) {
+        perror("Failed to allocate memory for folds");
+        exit(EXIT_FAILURE);
+    }
+    memset(fold_starts, 0, (k + 1) * sizeof(int));
+    int fold = 0;
+    for (int g = 0; g < groups.count; g++) {
+        int *members = groups.members + groups.starts[g];
+        int label_count = groups.starts[g + 1] - groups.starts[g];
+        label_group_shuffle(&rng, members, label_count, label_count > 0 ? label_count - 1 : 0);
+        for (int i = 0; i < label_count; i++) {
+            fold_of[members[i]] = fold;
+            fold_starts[fold + 1]++;
+            fold = fold + 1 < k ? fold + 1 : 0;
+        }
+    }
+    label_groups_free(&groups);
+
+    for (int f = 0; f < k; f++) {
+        fold_starts[f + 1] += fold_starts[f];
+    }
+    /* Fill the folds in index order, using the entries of fold_starts as positions and shifting them back */
+    for (int i = 0; i < num_labels; i++) {
+        folds[fold_starts[fold_of[i]]++] = i;
+    }
+    for (int f = k; f > 0; f--) {
+        fold_starts[f] = fold_starts[f - 1];
+    }
+    fold_starts[0] = 0;
+    free(fold_of);
+    return folds;
+}
@@ -0,0 +1,258 @@
+/* Implementation of a work-stealing thread pool in C */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* Work-stealing parallel loops
+ * A loop over [0, count) starts with one contiguous range per worker. Workers take
+ * grain-sized chunks from the front of their own range and, once it is empty, steal
+ * the back half of the fullest range of another worker, so uneven chunks rebalance
+ * without a central queue. The calling thread takes part as worker 0. Loops must not
+ * be nested on the same pool. */
+
+/* Body of a parallel loop, called on [begin, end) by the worker of the given id */
+typedef void (*PoolTask)(void *context, int begin, int end, int worker);
+
+/* Define the PoolRange structure */
+typedef struct PoolRange {
+    pthread_mutex_t lock;
+    int begin;
+    int end;
+} PoolRange;
+
+/* Define the ThreadPool structure */
+typedef struct ThreadPool {
+    int threads;
+    pthread_t *handles;
+    struct PoolWorker *workers;
+    PoolRange *ranges;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned long generation; // incremented for every loop
+    int active; // helper workers still running the current loop
+    bool stop;
+    PoolTask task;
+    void *context;
+    int grain;
+} ThreadPool;
+
+/* Define the PoolWorker structure */
+typedef struct PoolWorker {
+    ThreadPool *pool;
+    int id;
+} PoolWorker;
+
+/* Function prototypes */
+ThreadPool *create_thread_pool(int threads);
+void free_thread_pool(ThreadPool *pool);
+int thread_pool_size(ThreadPool *pool);
+void parallel_for(ThreadPool *pool, int count, int grain, PoolTask task, void *context);
+
+/* Function implementations */
+
+/* Take the next chunk of a worker range, or steal half of another one */
+static bool pool_next_chunk(ThreadPool *pool, int worker, int *begin, int *end) {
+    PoolRange *own = &pool->ranges[worker];
+    pthread_mutex_lock(&own->lock);
+    if (own->begin < own->end) {
+        *begin = own->begin;
+        *end = own->begin + pool->grain < own->end ? own->begin + pool->grain : own->end;
+        own->begin = *end;
+        pthread_mutex_unlock(&own->lock);
+        return true;
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    /* Steal from the range with the most work left */
+    for (;;) {
+        int victim = -1;
+        int most = 0;
+        for (int i = 0; i < pool->threads; i++) {
+            if (i == worker) {
+                continue;
+            }
+            pthread_mutex_lock(&pool->ranges[i].lock);
+            int left = pool->ranges[i].end - pool->ranges[i].begin;
+            pthread_mutex_unlock(&pool->ranges[i].lock);
+            if (left > most) {
+                most = left;
+                victim = i;
+            }
+        }
+        if (victim == -1) {
+            return false;
+        }
+        PoolRange *range = &pool->ranges[victim];
+        pthread_mutex_lock(&range->lock);
+        int left = range->end - range->begin;
+        if (left <= 0) {
+            pthread_mutex_unlock(&range->lock);
+            continue;
+        }
+        int middle = left > pool->grain ? range->begin + left / 2 : range->begin;
+        int stolen_end = range->end;
+        range->end = middle;
+        pthread_mutex_unlock(&range->lock);
+
+        pthread_mutex_lock(&own->lock);
+        own->begin = middle;
+        own->end = stolen_end;
+        *begin = own->begin;
+        *end = own->begin + pool->grain < own->end ? own->begin + pool->grain : own->end;
+        own->begin = *end;
+        pthread_mutex_unlock(&own->lock);
+        return true;
+    }
+}
+
+/* Run chunks of the current loop until no work is left anywhere */
+static void pool_run(ThreadPool *pool, int worker) {
+    int begin, end;
+    while (pool_next_chunk(pool, worker, &begin, &end)) {
+        pool->task(pool->context, begin, end, worker);
+    }
+}
+
+/* Main loop of a helper worker */
+static void *pool_worker_main(void *arg) {
+    PoolWorker *self = (PoolWorker *)arg;
+    ThreadPool *pool = self->pool;
+    unsigned long seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->stop && pool->generation == seen) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->stop) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        pool_run(pool, self->id);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->active == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/* Create a pool of threads, 0 for one per online CPU */
+ThreadPool *create_thread_pool(int threads) {
+    if (threads <= 0) {
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (threads < 1) {
+            threads = 1;
+        }
+    }
+
+    ThreadPool *pool = (ThreadPool *)malloc(sizeof(ThreadPool));
+    if (!pool) {
+        perror("Failed to allocate memory for ThreadPool");
+        exit(EXIT_FAILURE);
+    }
+    pool->threads = threads;
+    pool->handles = (pthread_t *)malloc(threads * sizeof(pthread_t));
+    pool->workers = (PoolWorker *)malloc(threads * sizeof(PoolWorker));
+    pool->ranges = (PoolRange *)malloc(threads * sizeof(PoolRange));
+    if (!pool->handles || !pool->workers || !pool->ranges) {
+        perror("Failed to allocate memory for ThreadPool");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->generation = 0;
+    pool->active = 0;
+    pool->stop = false;
+    pool->task = NULL;
+    pool->context = NULL;
+    pool->grain = 1;
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_init(&pool->ranges[i].lock, NULL);
+        pool->ranges[i].begin = 0;
+        pool->ranges[i].end = 0;
+        pool->workers[i].pool = pool;
+        pool->workers[i].id = i;
+    }
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&pool->handles[i], NULL, pool_worker_main, &pool->workers[i]) != 0) {
+            perror("Failed to start pool thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return pool;
+}
+
+/* Stop the threads and free a ThreadPool */
+void free_thread_pool(ThreadPool *pool) {
+    if (pool) {
+        pthread_mutex_lock(&pool->lock);
+        pool->stop = true;
+        pthread_cond_broadcast(&pool->start);
+        pthread_mutex_unlock(&pool->lock);
+        for (int i = 1; i < pool->threads; i++) {
+            pthread_join(pool->handles[i], NULL);
+        }
+        for (int i = 0; i < pool->threads; i++) {
+            pthread_mutex_destroy(&pool->ranges[i].lock);
+        }
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->start);
+        pthread_cond_destroy(&pool->done);
+        free(pool->handles);
+        free(pool->workers);
+        free(pool->ranges);
+        free(pool);
+    }
+}
+
+/* Number of workers of a pool, including the calling thread */
+int thread_pool_size(ThreadPool *pool) {
+    return pool->threads;
+}
+
+/* Run task over [0, count) in chunks of at most grain iterations */
+void parallel_for(ThreadPool *pool, int count, int grain, PoolTask task, void *context) {
+    if (count <= 0) {
+        return;
+    }
+    if (grain < 1) {
+        grain = 1;
+    }
+    if (pool->threads == 1 || count <= grain) {
+        task(context, 0, count, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->context = context;
+    pool->grain = grain;
+    for (int i = 0; i < pool->threads; i++) {
+        pthread_mutex_lock(&pool->ranges[i].lock);
+        pool->ranges[i].begin = (int)((long)count * i / pool->threads);
+        pool->ranges[i].end = (int)((long)count * (i + 1) / pool->threads);
+        pthread_mutex_unlock(&pool->ranges[i].lock);
+    }
+    pool->active = pool->threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    pool_run(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->active > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -7,12 +7,21 @@
 #include <errno.h>
 #include <uuid/uuid.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 /* Define the Vector structure */
 typedef struct Vector {
     char *name;
     int size;
     int *vector;
+    uint64_t *bits; // 1 bit per dimension when packed (bipolar: set bit is -1)
+    bool packed;
+    bool borrowed; // elements are owned by a dense Space, not by the Vector
     char *vtype; // "binary" or "bipolar"
     char **tags;
     int tags_count;
@@ -20,6 +29,24 @@ typedef struct Vector {
     bool warning;
 } Vector;
 
+/* Number of 64-bit words holding a packed vector of the given size */
+#define PACKED_WORDS(size) (((size) + 63) / 64)
+
+/* Read-only view of a vector rotated by an offset: element i of the view is element
+ * (i - offset) mod size of the base, as after permute_vector(base, offset) */
+typedef struct VectorView {
+    Vector *base;
+    int offset; // in [0, size)
+} VectorView;
+
+/* Define the random number generator state */
+typedef struct Rng {
+    uint64_t state[4];
+} Rng;
+
+/* Approximate nearest-neighbour index, defined in lsh.c */
+typedef struct LshIndex LshIndex;
+
 /* Define the Space structure */
 typedef struct Space {
     Vector **vectors;
@@ -28,17 +55,62 @@ typedef struct Space {
     char *vtype; // "binary" or "bipolar"
     char **tags;
     int tags_count;
+    int capacity; // allocated slots in vectors, name_hashes and matrix rows
+    bool dense; // vector elements live in one row-major matrix
+    bool packed; // dense matrix rows hold packed bits
+    void *matrix; // 64-byte aligned block of capacity rows when dense
+    size_t row_stride; // bytes per matrix row, a multiple of 64
+    int *index; // open-addressing table of vector positions keyed by name, -1 if empty
+    int index_capacity; // power of two, kept at least twice vector_count
+    uint64_t *name_hashes; // hash of each vector name, parallel to vectors
+    LshIndex *ann; // optional approximate nearest-neighbour index, NULL if none
+    void (*ann_insert)(LshIndex *index, Vector *vec, int position); // installed with the index
+    void (*ann_free)(LshIndex *index);
+    void *mapping; // file mapped by load_space, NULL otherwise
+    size_t mapping_length;
+    int mapped_count; // vectors loaded with the mapping, whose tables are still current
+    int fd; // backing file of an out-of-core Space, -1 if none
+    void (*sync)(struct Space *space); // installed by open_space with the file
+    size_t matrix_offset; // file offset of the matrix of an out-of-core Space
 } Space;
 
+/* Supported distance methods */
+typedef enum DistanceMethod {
+    DISTANCE_COSINE,
+    DISTANCE_HAMMING,
+    DISTANCE_EUCLIDEAN
+} DistanceMethod;
+
 /* Function prototypes */
+uint64_t hash_string(const char *str);
+uint64_t rng_entropy_seed(void);
+void rng_init(Rng *rng, uint64_t seed, uint64_t stream);
+uint64_t rng_next(Rng *rng);
+uint64_t rng_bounded(Rng *rng, uint64_t bound);
 Vector *create_vector(const char *name, int size, const char *vtype, int seed, bool warning);
+Vector *create_packed_vector(const char *name, int size, const char *vtype, int seed, bool warning);
+Vector *alloc_vector(const char *name, int size, const char *vtype, bool packed);
+void pack_vector(Vector *vec);
+void unpack_vector(Vector *vec);
 void free_vector(Vector *vec);
 void print_vector(Vector *vec);
 Space *create_space(int size, const char *vtype);
+Space *create_dense_space(int size, const char *vtype, bool packed);
+void *space_row(Space *space, int position);
+void prefetch_space(Space *space, int first, int count);
 void free_space(Space *space);
 void insert_vector(Space *space, Vector *vec);
+Vector *get_vector_from_space(Space *space, const char *name);
+int space_vector_position(Space *space, const char *name);
 void print_space(Space *space);
 double vector_distance(Vector *vec1, Vector *vec2, const char *method);
+double vector_distance_by(Vector *vec1, Vector *vec2, DistanceMethod method);
+VectorView vector_view(Vector *vec, int rotate_by);
+double vector_view_distance(Vector *vec, VectorView view, DistanceMethod method);
+DistanceMethod parse_distance_method(const char *method);
+const char *distance_kernels_name(void);
+void set_space_threads(int threads);
+void space_search(Space *space, Vector **queries, int nq, int k, const char *method, int *out_ids, double *out_dists);
 void normalize_vector(Vector *vec);
 Vector *bind_vectors(Vector *vec1, Vector *vec2);
 Vector *bundle_vectors(Vector *vec1, Vector *vec2);
@@ -47,12 +119,91 @@ void permute_vector(Vector *vec, int rotate_by);
 
 /* Function implementations */
 
+/* Random number generation
+ * xoshiro256** streams seeded through splitmix64. A stream is keyed by a seed and a
+ * stream id (usually the hash of a vector name), so the same (seed, name) pair always
+ * gives the same vector, on any thread and in any creation order. */
+
+/* Advance a splitmix64 state and return its next output */
+static inline uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += UINT64_C(0x9E3779B97F4A7C15));
+    z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+    return z ^ (z >> 31);
+}
+
+/* Hash a string with 64-bit FNV-1a */
+uint64_t hash_string(const char *str) {
+    uint64_t hash = UINT64_C(0xCBF29CE484222325);
+    for (const unsigned char *c = (const unsigned char *)str; *c; c++) {
+        hash = (hash ^ *c) * UINT64_C(0x100000001B3);
+    }
+    return hash;
+}
+
+/* Draw a fresh seed for callers asking for a non-reproducible stream (seed -1) */
+uint64_t rng_entropy_seed(void) {
+    static _Atomic uint64_t counter = 0;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t state = ((uint64_t)now.tv_sec << 32) ^ (uint64_t)now.tv_nsec ^ (uint64_t)(uintptr_t)&now;
+    state ^= splitmix64(&(uint64_t){ counter++ });
+    return splitmix64(&state);
+}
+
+/* Initialize the stream identified by (seed, stream) */
+void rng_init(Rng *rng, uint64_t seed, uint64_t stream) {
+    uint64_t key = seed;
+    key = splitmix64(&key) ^ stream;
+    for (int i = 0; i < 4; i++) {
+        rng->state[i] = splitmix64(&key);
+    }
+}
+
+/* Next 64 random bits */
+uint64_t rng_next(Rng *rng) {
+    uint64_t *s = rng->state;
+    uint64_t result = s[1] * 5;
+    result = ((result << 7) | (result >> 57)) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 45) | (s[3] >> 19);
+    return result;
+}
+
+/* Uniform integer in [0, bound) without modulo bias */
+uint64_t rng_bounded(Rng *rng, uint64_t bound) {
+    __uint128_t product = (__uint128_t)rng_next(rng) * bound;
+    uint64_t low = (uint64_t)product;
+    if (low < bound) {
+        uint64_t threshold = -bound % bound;
+        while (low < threshold) {
+            product = (__uint128_t)rng_next(rng) * bound;
+            low = (uint64_t)product;
+        }
+    }
+    return (uint64_t)(product >> 64);
+}
+
+/* Initialize the stream of a named vector, drawing a fresh seed when seed is -1 */
+static void rng_init_vector(Rng *rng, const char *name, int seed) {
+    rng_init(rng, seed != -1 ? (uint64_t)seed : rng_entropy_seed(), hash_string(name));
+}
+
 /* Create a new Vector */
 Vector *create_vector(const char *name, int size, const char *vtype, int seed, bool warning) {
     if (size < 10000) {
         fprintf(stderr, "Vector size must be greater than or equal to 10000\n");
         exit(EXIT_FAILURE);
     }
+    if (strcmp(vtype, "binary") != 0 && strcmp(vtype, "bipolar") != 0) {
+        fprintf(stderr, "Vector type can be binary or bipolar only\n");
+        exit(EXIT_FAILURE);
+    }
 
     Vector *vec = (Vector *)malloc(sizeof(Vector));
     if (!vec) {
@@ -67,6 +218,9 @@ Vector *create_vector(const char *name, int size, const char *vtype, int seed, b
     vec->warning = warning;
     vec->tags = NULL;
     vec->tags_count = 0;
+    vec->borrowed = false;
+    vec->bits = NULL;
+    vec->packed = false;
 
     /* Initialize the vector */
     vec->vector = (int *)malloc(size * sizeof(int));
@@ -76,28 +230,221 @@ Vector *create_vector(const char *name, int size, const char *vtype, int seed, b
         exit(EXIT_FAILURE);
     }
 
-    /* Seed the random number generator */
-    if (seed != -1) {
-        srand(seed);
+    /* Generate random vector, 64 elements per draw
+     * Elements follow the packed bit encoding, so create_packed_vector draws the same vector */
+    Rng rng;
+    rng_init_vector(&rng, name, seed);
+    bool binary = strcmp(vtype, "binary") == 0;
+    for (int i = 0; i < size; i += 64) {
+        uint64_t bits = rng_next(&rng);
+        int count = size - i < 64 ? size - i : 64;
+        for (int j = 0; j < count; j++) {
+            int bit = (int)((bits >> j) & 1);
+            vec->vector[i + j] = binary ? bit : 1 - 2 * bit;
+        }
+    }
+
+    return vec;
+}
+
+/* Allocate a zero-filled Vector without drawing random elements */
+Vector *alloc_vector(const char *name, int size, const char *vtype, bool packed) {
+    if (size < 10000) {
+        fprintf(stderr, "Vector size must be greater than or equal to 10000\n");
+        exit(EXIT_FAILURE);
+    }
+    if (strcmp(vtype, "binary") != 0 && strcmp(vtype, "bipolar") != 0) {
+        fprintf(stderr, "Vector type can be binary or bipolar only\n");
+        exit(EXIT_FAILURE);
+    }
+
+    Vector *vec = (Vector *)malloc(sizeof(Vector));
+    if (!vec) {
+        perror("Failed to allocate memory for Vector");
+        exit(EXIT_FAILURE);
+    }
+
+    vec->name = strdup(name);
+    vec->size = size;
+    vec->vtype = strdup(vtype);
+    vec->seed = -1;
+    vec->warning = false;
+    vec->tags = NULL;
+    vec->tags_count = 0;
+    vec->borrowed = false;
+    vec->packed = packed;
+    vec->vector = NULL;
+    vec->bits = NULL;
+    if (packed) {
+        vec->bits = (uint64_t *)calloc(PACKED_WORDS(size), sizeof(uint64_t));
     } else {
-        srand(time(NULL));
+        vec->vector = (int *)calloc(size, sizeof(int));
+    }
+    if (!vec->vector && !vec->bits) {
+        perror("Failed to allocate memory for vector elements");
+        free(vec->name);
+        free(vec->vtype);
+        free(vec);
+        exit(EXIT_FAILURE);
     }
 
-    /* Generate random vector */
-    for (int i = 0; i < size; i++) {
-        int rand_value = rand() % 2;
-        if (strcmp(vtype, "binary") == 0) {
-            vec->vector[i] = rand_value;
-        } else if (strcmp(vtype, "bipolar") == 0) {
-            vec->vector[i] = rand_value == 0 ? -1 : 1;
-        } else {
-            fprintf(stderr, "Vector type can be binary or bipolar only\n");
-            free_vector(vec);
+    return vec;
+}
+
+/* Create a new random Vector stored with 1 bit per dimension */
+Vector *create_packed_vector(const char *name, int size, const char *vtype, int seed, bool warning) {
+    if (size < 10000) {
+        fprintf(stderr, "Vector size must be greater than or equal to 10000\n");
+        exit(EXIT_FAILURE);
+    }
+    if (strcmp(vtype, "binary") != 0 && strcmp(vtype, "bipolar") != 0) {
+        fprintf(stderr, "Vector type can be binary or bipolar only\n");
+        exit(EXIT_FAILURE);
+    }
+
+    Vector *vec = (Vector *)malloc(sizeof(Vector));
+    if (!vec) {
+        perror("Failed to allocate memory for Vector");
+        exit(EXIT_FAILURE);
+    }
+
+    vec->name = strdup(name);
+    vec->size = size;
+    vec->vtype = strdup(vtype);
+    vec->seed = seed;
+    vec->warning = warning;
+    vec->tags = NULL;
+    vec->tags_count = 0;
+    vec->borrowed = false;
+    vec->vector = NULL;
+    vec->packed = true;
+
+    /* Trailing bits of the last word are always kept to zero */
+    vec->bits = (uint64_t *)calloc(PACKED_WORDS(size), sizeof(uint64_t));
+    if (!vec->bits) {
+        perror("Failed to allocate memory for vector elements");
+        free(vec);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Generate random bits, one word per draw */
+    Rng rng;
+    rng_init_vector(&rng, name, seed);
+    int words = PACKED_WORDS(size);
+    for (int i = 0; i < words; i++) {
+        vec->bits[i] = rng_next(&rng);
+    }
+    if (size % 64 != 0) {
+        vec->bits[words - 1] &= (UINT64_C(1) << (size % 64)) - 1;
+    }
+
+    return vec;
+}
+
+/* Get the i-th element of a Vector regardless of its storage */
+static inline int vector_element(const Vector *vec, int i) {
+    if (!vec->packed) {
+        return vec->vector[i];
+    }
+    int bit = (int)((vec->bits[i / 64] >> (i % 64)) & 1);
+    if (strcmp(vec->vtype, "binary") == 0) {
+        return bit;
+    }
+    return bit ? -1 : 1;
+}
+
+/* Convert a normalized binary or bipolar Vector to the packed representation */
+void pack_vector(Vector *vec) {
+    if (vec->packed) {
+        return;
+    }
+    if (vec->borrowed) {
+        fprintf(stderr, "Vector \"%s\" is stored in a dense space and cannot be packed\n", vec->name);
+        exit(EXIT_FAILURE);
+    }
+    bool binary = strcmp(vec->vtype, "binary") == 0;
+    uint64_t *bits = (uint64_t *)calloc(PACKED_WORDS(vec->size), sizeof(uint64_t));
+    if (!bits) {
+        perror("Failed to allocate memory for packed vector");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < vec->size; i++) {
+        int value = vec->vector[i];
+        if (binary ? (value != 0 && value != 1) : (value != -1 && value != 1)) {
+            fprintf(stderr, "Vector \"%s\" must be normalized before packing\n", vec->name);
+            free(bits);
             exit(EXIT_FAILURE);
         }
+        if (binary ? value == 1 : value == -1) {
+            bits[i / 64] |= UINT64_C(1) << (i % 64);
+        }
     }
+    free(vec->vector);
+    vec->vector = NULL;
+    vec->bits = bits;
+    vec->packed = true;
+}
 
-    return vec;
+/* Convert a packed Vector back to one int per dimension */
+void unpack_vector(Vector *vec) {
+    if (!vec->packed) {
+        return;
+    }
+    if (vec->borrowed) {
+        fprintf(stderr, "Vector \"%s\" is stored in a dense space and cannot be unpacked\n", vec->name);
+        exit(EXIT_FAILURE);
+    }
+    int *elements = (int *)malloc(vec->size * sizeof(int));
+    if (!elements) {
+        perror("Failed to allocate memory for vector elements");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < vec->size; i++) {
+        elements[i] = vector_element(vec, i);
+    }
+    free(vec->bits);
+    vec->bits = NULL;
+    vec->vector = elements;
+    vec->packed = false;
+}
+
+/* Read count (<= 64) consecutive bits starting at a bit position of a packed buffer */
+static inline uint64_t packed_read_bits(const uint64_t *bits, int start, int count) {
+    if (count == 0) {
+        return 0;
+    }
+    int word = start / 64;
+    int offset = start % 64;
+    uint64_t value = bits[word] >> offset;
+    if (offset != 0 && offset + count > 64) {
+        value |= bits[word + 1] << (64 - offset);
+    }
+    if (count < 64) {
+        value &= (UINT64_C(1) << count) - 1;
+    }
+    return value;
+}
+
+/* Word w of a packed buffer rotated by shift (in [0, size)) */
+static inline uint64_t packed_rotated_word(const uint64_t *src, int size, int shift, int w) {
+    int count = size - w * 64 < 64 ? size - w * 64 : 64;
+    int start = w * 64 - shift;
+    if (start < 0) {
+        start += size;
+    }
+    int head = size - start;
+    if (head >= count) {
+        return packed_read_bits(src, start, count);
+    }
+    return packed_read_bits(src, start, head) | (packed_read_bits(src, 0, count - head) << head);
+}
+
+/* Rotate a packed buffer so that bit i of src lands on bit (i + rotate_by) mod size of dst */
+static void packed_rotate(uint64_t *dst, const uint64_t *src, int size, int rotate_by) {
+    int shift = ((rotate_by % size) + size) % size;
+    for (int w = 0; w < PACKED_WORDS(size); w++) {
+        dst[w] = packed_rotated_word(src, size, shift, w);
+    }
 }
 
 /* Free a Vector */
@@ -105,7 +452,10 @@ void free_vector(Vector *vec) {
     if (vec) {
         free(vec->name);
         free(vec->vtype);
-        free(vec->vector);
+        if (!vec->borrowed) {
+            free(vec->vector);
+            free(vec->bits);
+        }
         if (vec->tags) {
             for (int i = 0; i < vec->tags_count; i++) {
                 free(vec->tags[i]);
@@ -127,7 +477,7 @@ void print_vector(Vector *vec) {
     }
     printf("\nVector Elements: [");
     for (int i = 0; i < vec->size; i++) {
-        printf("%d ", vec->vector[i]);
+        printf("%d ", vector_element(vec, i));
     }
     printf("]\n");
 }
@@ -151,28 +501,252 @@ Space *create_space(int size, const char *vtype) {
     space->vtype = strdup(vtype);
     space->tags = NULL;
     space->tags_count = 0;
+    space->capacity = 0;
+    space->dense = false;
+    space->packed = false;
+    space->matrix = NULL;
+    space->row_stride = 0;
+    space->index = NULL;
+    space->index_capacity = 0;
+    space->name_hashes = NULL;
+    space->ann = NULL;
+    space->ann_insert = NULL;
+    space->ann_free = NULL;
+    space->mapping = NULL;
+    space->mapping_length = 0;
+    space->mapped_count = 0;
+    space->fd = -1;
+    space->sync = NULL;
+    space->matrix_offset = 0;
 
     return space;
 }
 
-/* Free a Space */
+/* Create a new Space storing all vector elements in one contiguous matrix
+ * Inserted vectors hand their elements over to the matrix; their element pointers
+ * move whenever the matrix grows, so they must not be cached across insertions */
+Space *create_dense_space(int size, const char *vtype, bool packed) {
+    Space *space = create_space(size, vtype);
+    space->dense = true;
+    space->packed = packed;
+    size_t row_bytes = packed ? PACKED_WORDS(size) * sizeof(uint64_t) : size * sizeof(int);
+    space->row_stride = (row_bytes + 63) / 64 * 64;
+    return space;
+}
+
+/* Get the elements (int or packed words) of the vector at a position */
+void *space_row(Space *space, int position) {
+    if (space->dense) {
+        return (char *)space->matrix + (size_t)position * space->row_stride;
+    }
+    Vector *vec = space->vectors[position];
+    return vec->packed ? (void *)vec->bits : (void *)vec->vector;
+}
+
+/* Whether a buffer of the Space lives in its file mapping rather than on the heap */
+static bool space_mapped(const Space *space, const void *buffer) {
+    const char *start = (const char *)space->mapping;
+    return start && (const char *)buffer >= start && (const char *)buffer < start + space->mapping_length;
+}
+
+/* Copy the name index of a loaded Space out of its mapping, so that the mapping can be
+ * grown over it */
+static void space_detach_tables(Space *space) {
+    if (space_mapped(space, space->index)) {
+        int *index = (int *)malloc(space->index_capacity * sizeof(int));
+        if (!index) {
+            perror("Failed to allocate memory for space index");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(index, space->index, space->index_capacity * sizeof(int));
+        space->index = index;
+    }
+}
+
+/* Grow the file of an out-of-core Space to hold capacity rows and map it again */
+static void *space_file_reserve(Space *space, int capacity) {
+    space_detach_tables(space);
+    size_t length = space->matrix_offset + (size_t)capacity * space->row_stride;
+    if (ftruncate(space->fd, (off_t)length) != 0) {
+        perror("Failed to grow space file");
+        exit(EXIT_FAILURE);
+    }
+    munmap(space->mapping, space->mapping_length);
+    space->mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, space->fd, 0);
+    if (space->mapping == MAP_FAILED) {
+        perror("Failed to map space file");
+        exit(EXIT_FAILURE);
+    }
+    space->mapping_length = length;
+    return (char *)space->mapping + space->matrix_offset;
+}
+
+/* Grow the vector arrays, and the matrix of a dense Space, geometrically */
+static void space_reserve(Space *space, int capacity) {
+    if (capacity <= space->capacity) {
+        return;
+    }
+    int new_capacity = space->capacity ? space->capacity : 16;
+    while (new_capacity < capacity) {
+        new_capacity *= 2;
+    }
+    space->vectors = (Vector **)realloc(space->vectors, new_capacity * sizeof(Vector *));
+    if (space_mapped(space, space->name_hashes)) {
+        /* Loaded tables move to the heap on the first insertion */
+        uint64_t *name_hashes = (uint64_t *)malloc(new_capacity * sizeof(uint64_t));
+        if (name_hashes) {
+            memcpy(name_hashes, space->name_hashes, space->vector_count * sizeof(uint64_t));
+        }
+        space->name_hashes = name_hashes;
+    } else {
+        space->name_hashes = (uint64_t *)realloc(space->name_hashes, new_capacity * sizeof(uint64_t));
+    }
+    if (!space->vectors || !space->name_hashes) {
+        perror("Failed to allocate memory for vectors in space");
+        exit(EXIT_FAILURE);
+    }
+    if (space->dense && space->fd >= 0) {
+        /* Out-of-core rows stay in the file, which grows in place */
+        space->matrix = space_file_reserve(space, new_capacity);
+    } else if (space->dense) {
+        void *matrix = aligned_alloc(64, (size_t)new_capacity * space->row_stride);
+        if (!matrix) {
+            perror("Failed to allocate memory for space matrix");
+            exit(EXIT_FAILURE);
+        }
+        if (space->vector_count > 0) {
+            memcpy(matrix, space->matrix, (size_t)space->vector_count * space->row_stride);
+        }
+        if (!space_mapped(space, space->matrix)) {
+            free(space->matrix);
+        }
+        space->matrix = matrix;
+    }
+    if (space->dense) {
+        /* Rebase vectors onto the new rows */
+        for (int i = 0; i < space->vector_count; i++) {
+            if (space->packed) {
+                space->vectors[i]->bits = (uint64_t *)space_row(space, i);
+            } else {
+                space->vectors[i]->vector = (int *)space_row(space, i);
+            }
+        }
+    }
+    space->capacity = new_capacity;
+}
+
+/* Give the kernel a paging hint for rows [first, first + count) of a mapped dense Space */
+static void space_advise(Space *space, int first, int count, int advice) {
+    if (!space->dense || count <= 0 || !space_mapped(space, space->matrix)) {
+        return;
+    }
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)space_row(space, first) & ~(page - 1);
+    uintptr_t end = (uintptr_t)space_row(space, first + count);
+    /* Only a hint: failures are harmless */
+    madvise((void *)start, end - start, advice);
+}
+
+/* Ask the kernel to read ahead rows [first, first + count) of a Space loaded from a file,
+ * so that later accesses to them do not wait on page faults */
+void prefetch_space(Space *space, int first, int count) {
+    if (first < 0 || count < 0 || first + count > space->vector_count) {
+        fprintf(stderr, "Rows to prefetch are out of the space\n");
+        exit(EXIT_FAILURE);
+    }
+    space_advise(space, first, count, MADV_WILLNEED);
+}
+
+/* Free a Space, writing back the tables of an out-of-core one */
 void free_space(Space *space) {
     if (space) {
+        if (space->fd >= 0) {
+            space->sync(space);
+        }
         for (int i = 0; i < space->vector_count; i++) {
             free_vector(space->vectors[i]);
         }
         free(space->vectors);
+        if (!space_mapped(space, space->matrix)) {
+            free(space->matrix);
+        }
         free(space->vtype);
+        if (!space_mapped(space, space->index)) {
+            free(space->index);
+        }
+        if (!space_mapped(space, space->name_hashes)) {
+            free(space->name_hashes);
+        }
+        if (space->ann) {
+            space->ann_free(space->ann);
+        }
         if (space->tags) {
             for (int i = 0; i < space->tags_count; i++) {
                 free(space->tags[i]);
             }
             free(space->tags);
         }
+        if (space->mapping) {
+            munmap(space->mapping, space->mapping_length);
+        }
+        if (space->fd >= 0) {
+            close(space->fd);
+        }
         free(space);
     }
 }
 
+/* Find the index slot holding a name, or the empty slot where it would go */
+static int space_index_slot(Space *space, const char *name, uint64_t hash) {
+    int mask = space->index_capacity - 1;
+    int slot = (int)(hash & mask);
+    while (space->index[slot] != -1) {
+        int position = space->index[slot];
+        if (space->name_hashes[position] == hash && strcmp(space->vectors[position]->name, name) == 0) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/* Double the index capacity and rehash all vector positions */
+static void space_index_grow(Space *space) {
+    int capacity = space->index_capacity ? space->index_capacity * 2 : 64;
+    int *index = (int *)malloc(capacity * sizeof(int));
+    if (!index) {
+        perror("Failed to allocate memory for space index");
+        exit(EXIT_FAILURE);
+    }
+    memset(index, -1, capacity * sizeof(int));
+    for (int i = 0; i < space->vector_count; i++) {
+        int slot = (int)(space->name_hashes[i] & (capacity - 1));
+        while (index[slot] != -1) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        index[slot] = i;
+    }
+    if (!space_mapped(space, space->index)) {
+        free(space->index);
+    }
+    space->index = index;
+    space->index_capacity = capacity;
+}
+
+/* Get the position of a named Vector in a Space, or -1 if it is not there */
+int space_vector_position(Space *space, const char *name) {
+    if (space->vector_count == 0) {
+        return -1;
+    }
+    return space->index[space_index_slot(space, name, hash_string(name))];
+}
+
+/* Get a Vector from the Space by name */
+Vector *get_vector_from_space(Space *space, const char *name) {
+    int position = space_vector_position(space, name);
+    return position == -1 ? NULL : space->vectors[position];
+}
+
 /* Insert a Vector into a Space */
 void insert_vector(Space *space, Vector *vec) {
     if (space->size != vec->size) {
@@ -184,22 +758,54 @@ void insert_vector(Space *space, Vector *vec) {
         exit(EXIT_FAILURE);
     }
 
+    /* Keep the index at most half full */
+    if (2 * (space->vector_count + 1) > space->index_capacity) {
+        space_index_grow(space);
+    }
+
     /* Check if vector name already exists */
-    for (int i = 0; i < space->vector_count; i++) {
-        if (strcmp(space->vectors[i]->name, vec->name) == 0) {
-            fprintf(stderr, "Vector \"%s\" already in space\n", vec->name);
+    uint64_t hash = hash_string(vec->name);
+    int slot = space_index_slot(space, vec->name, hash);
+    if (space->index[slot] != -1) {
+        fprintf(stderr, "Vector \"%s\" already in space\n", vec->name);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Insert the vector */
+    space_reserve(space, space->vector_count + 1);
+    int position = space->vector_count++;
+    space->vectors[position] = vec;
+    space->name_hashes[position] = hash;
+    space->index[slot] = position;
+
+    /* Move the elements into the matrix row */
+    if (space->dense) {
+        if (vec->borrowed) {
+            fprintf(stderr, "Vector \"%s\" is already stored in a dense space\n", vec->name);
             exit(EXIT_FAILURE);
         }
+        if (space->packed) {
+            pack_vector(vec);
+        } else {
+            unpack_vector(vec);
+        }
+        void *row = space_row(space, position);
+        memset(row, 0, space->row_stride);
+        if (space->packed) {
+            memcpy(row, vec->bits, PACKED_WORDS(vec->size) * sizeof(uint64_t));
+            free(vec->bits);
+            vec->bits = (uint64_t *)row;
+        } else {
+            memcpy(row, vec->vector, vec->size * sizeof(int));
+            free(vec->vector);
+            vec->vector = (int *)row;
+        }
+        vec->borrowed = true;
     }
 
-    /* Insert the vector */
-    space->vector_count++;
-    space->vectors = (Vector **)realloc(space->vectors, space->vector_count * sizeof(Vector *));
-    if (!space->vectors) {
-        perror("Failed to allocate memory for vectors in space");
-        exit(EXIT_FAILURE);
+    if (space->ann) {
+        space->ann_insert(space->ann, vec, position);
     }
-    space->vectors[space->vector_count - 1] = vec;
 }
 
 /* Print a Space */
@@ -213,8 +819,327 @@ void print_space(Space *space) {
     }
 }
 
+/* Distance kernels
+ * Each kernel works on raw element buffers and accumulates in 64-bit integers, so
+ * results are exact for any element magnitude below 2^30. The implementation used
+ * by vector_distance is selected once at startup from the CPU features. */
+
+/* Dot product and both squared norms in a single pass */
+static void cosine_terms_scalar(const int *a, const int *b, int n, int64_t terms[3]) {
+    int64_t dot_product = 0, norm_a = 0, norm_b = 0;
+    for (int i = 0; i < n; i++) {
+        dot_product += (int64_t)a[i] * b[i];
+        norm_a += (int64_t)a[i] * a[i];
+        norm_b += (int64_t)b[i] * b[i];
+    }
+    terms[0] = dot_product;
+    terms[1] = norm_a;
+    terms[2] = norm_b;
+}
+
+/* Number of positions with different elements */
+static int64_t hamming_scalar(const int *a, const int *b, int n) {
+    int64_t count = 0;
+    for (int i = 0; i < n; i++) {
+        count += a[i] != b[i];
+    }
+    return count;
+}
+
+/* Sum of squared element differences */
+static int64_t squared_diff_scalar(const int *a, const int *b, int n) {
+    int64_t sum = 0;
+    for (int i = 0; i < n; i++) {
+        int64_t diff = (int64_t)a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+/* Number of set bits in the XOR of two packed buffers */
+static int64_t popcount_xor_scalar(const uint64_t *a, const uint64_t *b, int words) {
+    int64_t count = 0;
+    for (int i = 0; i < words; i++) {
+        count += __builtin_popcountll(a[i] ^ b[i]);
+    }
+    return count;
+}
+
+/* Number of set bits in the AND of two packed buffers */
+static int64_t popcount_and_scalar(const uint64_t *a, const uint64_t *b, int words) {
+    int64_t count = 0;
+    for (int i = 0; i < words; i++) {
+        count += __builtin_popcountll(a[i] & b[i]);
+    }
+    return count;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__((target("popcnt")))
+static int64_t popcount_xor_popcnt(const uint64_t *a, const uint64_t *b, int words) {
+    int64_t count = 0;
+    for (int i = 0; i < words; i++) {
+        count += __builtin_popcountll(a[i] ^ b[i]);
+    }
+    return count;
+}
+
+__attribute__((target("popcnt")))
+static int64_t popcount_and_popcnt(const uint64_t *a, const uint64_t *b, int words) {
+    int64_t count = 0;
+    for (int i = 0; i < words; i++) {
+        count += __builtin_popcountll(a[i] & b[i]);
+    }
+    return count;
+}
+
+__attribute__((target("avx2")))
+static inline int64_t hsum_epi64_avx2(__m256i v) {
+    __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    return _mm_cvtsi128_si64(sum) + _mm_extract_epi64(sum, 1);
+}
+
+/* Exact 64-bit products of signed 32-bit lanes: even lanes, then odd lanes */
+__attribute__((target("avx2")))
+static inline __m256i madd_epi32_epi64_avx2(__m256i acc, __m256i a, __m256i b) {
+    acc = _mm256_add_epi64(acc, _mm256_mul_epi32(a, b));
+    return _mm256_add_epi64(acc, _mm256_mul_epi32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32)));
+}
+
+__attribute__((target("avx2")))
+static void cosine_terms_avx2(const int *a, const int *b, int n, int64_t terms[3]) {
+    __m256i dot_product = _mm256_setzero_si256();
+    __m256i norm_a = _mm256_setzero_si256();
+    __m256i norm_b = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        dot_product = madd_epi32_epi64_avx2(dot_product, va, vb);
+        norm_a = madd_epi32_epi64_avx2(norm_a, va, va);
+        norm_b = madd_epi32_epi64_avx2(norm_b, vb, vb);
+    }
+    cosine_terms_scalar(a + i, b + i, n - i, terms);
+    terms[0] += hsum_epi64_avx2(dot_product);
+    terms[1] += hsum_epi64_avx2(norm_a);
+    terms[2] += hsum_epi64_avx2(norm_b);
+}
+
+__attribute__((target("avx2")))
+static int64_t hamming_avx2(const int *a, const int *b, int n) {
+    int64_t equal = 0;
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        equal += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(va, vb))));
+    }
+    return (i - equal) + hamming_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static int64_t squared_diff_avx2(const int *a, const int *b, int n) {
+    __m256i sum = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i diff = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                        _mm256_loadu_si256((const __m256i *)(b + i)));
+        sum = madd_epi32_epi64_avx2(sum, diff, diff);
+    }
+    return hsum_epi64_avx2(sum) + squared_diff_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i madd_epi32_epi64_avx512(__m512i acc, __m512i a, __m512i b) {
+    acc = _mm512_add_epi64(acc, _mm512_mul_epi32(a, b));
+    return _mm512_add_epi64(acc, _mm512_mul_epi32(_mm512_srli_epi64(a, 32), _mm512_srli_epi64(b, 32)));
+}
+
+__attribute__((target("avx512f")))
+static void cosine_terms_avx512(const int *a, const int *b, int n, int64_t terms[3]) {
+    __m512i dot_product = _mm512_setzero_si512();
+    __m512i norm_a = _mm512_setzero_si512();
+    __m512i norm_b = _mm512_setzero_si512();
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i va = _mm512_loadu_si512((const void *)(a + i));
+        __m512i vb = _mm512_loadu_si512((const void *)(b + i));
+        dot_product = madd_epi32_epi64_avx512(dot_product, va, vb);
+        norm_a = madd_epi32_epi64_avx512(norm_a, va, va);
+        norm_b = madd_epi32_epi64_avx512(norm_b, vb, vb);
+    }
+    cosine_terms_scalar(a + i, b + i, n - i, terms);
+    terms[0] += _mm512_reduce_add_epi64(dot_product);
+    terms[1] += _mm512_reduce_add_epi64(norm_a);
+    terms[2] += _mm512_reduce_add_epi64(norm_b);
+}
+
+__attribute__((target("avx512f")))
+static int64_t hamming_avx512(const int *a, const int *b, int n) {
+    int64_t count = 0;
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i va = _mm512_loadu_si512((const void *)(a + i));
+        __m512i vb = _mm512_loadu_si512((const void *)(b + i));
+        count += __builtin_popcount(_mm512_cmpneq_epi32_mask(va, vb));
+    }
+    return count + hamming_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static int64_t squared_diff_avx512(const int *a, const int *b, int n) {
+    __m512i sum = _mm512_setzero_si512();
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i diff = _mm512_sub_epi32(_mm512_loadu_si512((const void *)(a + i)),
+                                        _mm512_loadu_si512((const void *)(b + i)));
+        sum = madd_epi32_epi64_avx512(sum, diff, diff);
+    }
+    return _mm512_reduce_add_epi64(sum) + squared_diff_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static int64_t popcount_xor_avx512(const uint64_t *a, const uint64_t *b, int words) {
+    __m512i count = _mm512_setzero_si512();
+    int i = 0;
+    for (; i + 8 <= words; i += 8) {
+        __m512i x = _mm512_xor_si512(_mm512_loadu_si512((const void *)(a + i)), _mm512_loadu_si512((const void *)(b + i)));
+        count = _mm512_add_epi64(count, _mm512_popcnt_epi64(x));
+    }
+    return _mm512_reduce_add_epi64(count) + popcount_xor_scalar(a + i, b + i, words - i);
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static int64_t popcount_and_avx512(const uint64_t *a, const uint64_t *b, int words) {
+    __m512i count = _mm512_setzero_si512();
+    int i = 0;
+    for (; i + 8 <= words; i += 8) {
+        __m512i x = _mm512_and_si512(_mm512_loadu_si512((const void *)(a + i)), _mm512_loadu_si512((const void *)(b + i)));
+        count = _mm512_add_epi64(count, _mm512_popcnt_epi64(x));
+    }
+    return _mm512_reduce_add_epi64(count) + popcount_and_scalar(a + i, b + i, words - i);
+}
+#endif
+
+/* Distance kernels selected at startup */
+static struct {
+    const char *name;
+    void (*cosine_terms)(const int *a, const int *b, int n, int64_t terms[3]);
+    int64_t (*hamming)(const int *a, const int *b, int n);
+    int64_t (*squared_diff)(const int *a, const int *b, int n);
+    int64_t (*popcount_xor)(const uint64_t *a, const uint64_t *b, int words);
+    int64_t (*popcount_and)(const uint64_t *a, const uint64_t *b, int words);
+} distance_kernels = {
+    "scalar", cosine_terms_scalar, hamming_scalar, squared_diff_scalar, popcount_xor_scalar, popcount_and_scalar
+};
+
+/* Pick the widest kernels supported by the running CPU */
+__attribute__((constructor))
+static void select_distance_kernels(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("popcnt")) {
+        distance_kernels.popcount_xor = popcount_xor_popcnt;
+        distance_kernels.popcount_and = popcount_and_popcnt;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        distance_kernels.name = "avx2";
+        distance_kernels.cosine_terms = cosine_terms_avx2;
+        distance_kernels.hamming = hamming_avx2;
+        distance_kernels.squared_diff = squared_diff_avx2;
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        distance_kernels.name = "avx512";
+        distance_kernels.cosine_terms = cosine_terms_avx512;
+        distance_kernels.hamming = hamming_avx512;
+        distance_kernels.squared_diff = squared_diff_avx512;
+        if (__builtin_cpu_supports("avx512vpopcntdq")) {
+            distance_kernels.popcount_xor = popcount_xor_avx512;
+            distance_kernels.popcount_and = popcount_and_avx512;
+        }
+    }
+#endif
+}
+
+/* Name of the distance kernels in use */
+const char *distance_kernels_name(void) {
+    return distance_kernels.name;
+}
+
+/* Map a distance method name to its identifier */
+DistanceMethod parse_distance_method(const char *method) {
+    if (strcmp(method, "cosine") == 0) {
+        return DISTANCE_COSINE;
+    } else if (strcmp(method, "hamming") == 0) {
+        return DISTANCE_HAMMING;
+    } else if (strcmp(method, "euclidean") == 0) {
+        return DISTANCE_EUCLIDEAN;
+    }
+    fprintf(stderr, "Distance method \"%s\" is not supported\n", method);
+    exit(EXIT_FAILURE);
+}
+
+/* Cosine distance from a dot product and both squared norms */
+static inline double cosine_distance_from_terms(int64_t dot_product, int64_t norm_a, int64_t norm_b) {
+    return 1.0 - ((double)dot_product / (sqrt((double)norm_a) * sqrt((double)norm_b)));
+}
+
+/* Distance between two packed rows from the popcount of their XOR (all but binary cosine) */
+static double packed_distance_from_hamming(int64_t hamming, int size, bool binary, DistanceMethod method) {
+    switch (method) {
+        case DISTANCE_COSINE:
+            /* Bipolar dot product is size - 2 * hamming and both norms are sqrt(size) */
+            return 2.0 * (double)hamming / size;
+        case DISTANCE_HAMMING:
+            return (double)hamming;
+        case DISTANCE_EUCLIDEAN:
+            /* Bipolar elements differ by 2 wherever bits differ */
+            return sqrt((double)(binary ? hamming : 4 * hamming));
+    }
+    fprintf(stderr, "Distance method %d is not supported\n", (int)method);
+    exit(EXIT_FAILURE);
+}
+
+/* Distance between two rows of elements (int, or packed words when packed is set) */
+static double row_distance(const void *row1, const void *row2, int size, bool packed, bool binary, DistanceMethod method) {
+    if (packed) {
+        /* Word-parallel kernels: every distance derives from XOR/AND popcounts */
+        const uint64_t *bits1 = (const uint64_t *)row1;
+        const uint64_t *bits2 = (const uint64_t *)row2;
+        int words = PACKED_WORDS(size);
+        if (method == DISTANCE_COSINE && binary) {
+            int64_t dot_product = distance_kernels.popcount_and(bits1, bits2, words);
+            int64_t norm_a = distance_kernels.popcount_and(bits1, bits1, words);
+            int64_t norm_b = distance_kernels.popcount_and(bits2, bits2, words);
+            return cosine_distance_from_terms(dot_product, norm_a, norm_b);
+        }
+        return packed_distance_from_hamming(distance_kernels.popcount_xor(bits1, bits2, words), size, binary, method);
+    }
+
+    switch (method) {
+        case DISTANCE_COSINE: {
+            int64_t terms[3];
+            distance_kernels.cosine_terms((const int *)row1, (const int *)row2, size, terms);
+            return cosine_distance_from_terms(terms[0], terms[1], terms[2]);
+        }
+        case DISTANCE_HAMMING:
+            return (double)distance_kernels.hamming((const int *)row1, (const int *)row2, size);
+        case DISTANCE_EUCLIDEAN:
+            return sqrt((double)distance_kernels.squared_diff((const int *)row1, (const int *)row2, size));
+    }
+    fprintf(stderr, "Distance method %d is not supported\n", (int)method);
+    exit(EXIT_FAILURE);
+}
+
 /* Calculate distance between two vectors */
 double vector_distance(Vector *vec1, Vector *vec2, const char *method) {
+    return vector_distance_by(vec1, vec2, parse_distance_method(method));
+}
+
+/* Calculate distance between two vectors with an already parsed method */
+double vector_distance_by(Vector *vec1, Vector *vec2, DistanceMethod method) {
     if (vec1->size != vec2->size) {
         fprintf(stderr, "Vectors must have the same size\n");
         exit(EXIT_FAILURE);
@@ -223,36 +1148,315 @@ double vector_distance(Vector *vec1, Vector *vec2, const char *method) {
         fprintf(stderr, "Vectors must be of the same type\n");
         exit(EXIT_FAILURE);
     }
+    if (vec1->packed != vec2->packed) {
+        fprintf(stderr, "Vectors must be both packed or both unpacked\n");
+        exit(EXIT_FAILURE);
+    }
 
-    if (strcmp(method, "cosine") == 0) {
-        double dot_product = 0.0;
-        double norm_a = 0.0;
-        double norm_b = 0.0;
-        for (int i = 0; i < vec1->size; i++) {
-            dot_product += vec1->vector[i] * vec2->vector[i];
-            norm_a += vec1->vector[i] * vec1->vector[i];
-            norm_b += vec2->vector[i] * vec2->vector[i];
+    return row_distance(vec1->packed ? (const void *)vec1->bits : (const void *)vec1->vector,
+                        vec2->packed ? (const void *)vec2->bits : (const void *)vec2->vector,
+                        vec1->size, vec1->packed, strcmp(vec1->vtype, "binary") == 0, method);
+}
+
+/* View a vector rotated by rotate_by without copying it */
+VectorView vector_view(Vector *vec, int rotate_by) {
+    VectorView view;
+    view.base = vec;
+    view.offset = ((rotate_by % vec->size) + vec->size) % vec->size;
+    return view;
+}
+
+/* Words of a rotated packed view materialized at a time on the stack */
+#define VIEW_CHUNK_WORDS 64
+
+/* Distance between a vector and a rotated view, without materializing the rotation */
+double vector_view_distance(Vector *vec, VectorView view, DistanceMethod method) {
+    Vector *base = view.base;
+    if (vec->size != base->size) {
+        fprintf(stderr, "Vectors must have the same size\n");
+        exit(EXIT_FAILURE);
+    }
+    if (strcmp(vec->vtype, base->vtype) != 0) {
+        fprintf(stderr, "Vectors must be of the same type\n");
+        exit(EXIT_FAILURE);
+    }
+    if (vec->packed != base->packed) {
+        fprintf(stderr, "Vectors must be both packed or both unpacked\n");
+        exit(EXIT_FAILURE);
+    }
+    bool binary = strcmp(vec->vtype, "binary") == 0;
+
+    if (vec->packed) {
+        /* Rotated words are produced in small stack chunks and fed to the popcount kernels */
+        int words = PACKED_WORDS(vec->size);
+        bool and_terms = method == DISTANCE_COSINE && binary;
+        int64_t count = 0;
+        uint64_t rotated[VIEW_CHUNK_WORDS];
+        for (int start = 0; start < words; start += VIEW_CHUNK_WORDS) {
+            int chunk = words - start < VIEW_CHUNK_WORDS ? words - start : VIEW_CHUNK_WORDS;
+            for (int w = 0; w < chunk; w++) {
+                rotated[w] = packed_rotated_word(base->bits, base->size, view.offset, start + w);
+            }
+            count += and_terms ? distance_kernels.popcount_and(vec->bits + start, rotated, chunk)
+                               : distance_kernels.popcount_xor(vec->bits + start, rotated, chunk);
         }
-        return 1.0 - (dot_product / (sqrt(norm_a) * sqrt(norm_b)));
-    } else if (strcmp(method, "hamming") == 0) {
-        int count = 0;
-        for (int i = 0; i < vec1->size; i++) {
-            if (vec1->vector[i] != vec2->vector[i]) {
-                count++;
+        if (and_terms) {
+            /* Rotation does not change the norm of the view */
+            return cosine_distance_from_terms(count, distance_kernels.popcount_and(vec->bits, vec->bits, words),
+                                              distance_kernels.popcount_and(base->bits, base->bits, words));
+        }
+        return packed_distance_from_hamming(count, vec->size, binary, method);
+    }
+
+    /* The view is base[size - offset, size) followed by base[0, size - offset) */
+    int head = view.offset;
+    int tail = vec->size - head;
+    const int *a = vec->vector;
+    const int *b = base->vector;
+    switch (method) {
+        case DISTANCE_COSINE: {
+            int64_t terms[3], tail_terms[3];
+            distance_kernels.cosine_terms(a, b + tail, head, terms);
+            distance_kernels.cosine_terms(a + head, b, tail, tail_terms);
+            return cosine_distance_from_terms(terms[0] + tail_terms[0], terms[1] + tail_terms[1], terms[2] + tail_terms[2]);
+        }
+        case DISTANCE_HAMMING:
+            return (double)(distance_kernels.hamming(a, b + tail, head) + distance_kernels.hamming(a + head, b, tail));
+        case DISTANCE_EUCLIDEAN:
+            return sqrt((double)(distance_kernels.squared_diff(a, b + tail, head) + distance_kernels.squared_diff(a + head, b, tail)));
+    }
+    fprintf(stderr, "Distance method %d is not supported\n", (int)method);
+    exit(EXIT_FAILURE);
+}
+
+/* Top-k search
+ * Work is split in tiles of a block of queries by a block of space rows, so a block
+ * of rows is read from memory once and reused across the whole block of queries.
+ * Tiles are numbered row block first, so the rows are walked once from start to end;
+ * a matrix mapped from a file is read sequentially, with read-ahead advised.
+ * Worker threads pull tiles from a shared counter and keep private top-k heaps that
+ * are merged at the end. Ties are broken by position, so results do not depend on
+ * the number of threads. */
+
+#define SEARCH_QUERY_BLOCK 8
+#define SEARCH_BLOCK_BYTES (256 * 1024)
+
+/* Number of threads used by space_search, 0 for one per online CPU */
+static int space_threads = 0;
+
+/* Set the number of threads used by space_search */
+void set_space_threads(int threads) {
+    space_threads = threads > 0 ? threads : 0;
+}
+
+/* Neighbour candidate kept in a search heap */
+typedef struct SearchHit {
+    double distance;
+    int position;
+} SearchHit;
+
+/* Whether hit a ranks after hit b */
+static inline bool search_hit_after(const SearchHit *a, const SearchHit *b) {
+    return a->distance > b->distance || (a->distance == b->distance && a->position > b->position);
+}
+
+/* Sift a hit down a max-heap of the given count */
+static void search_heap_sift_down(SearchHit *heap, int count, int i) {
+    for (;;) {
+        int largest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < count && search_hit_after(&heap[left], &heap[largest])) {
+            largest = left;
+        }
+        if (right < count && search_hit_after(&heap[right], &heap[largest])) {
+            largest = right;
+        }
+        if (largest == i) {
+            return;
+        }
+        SearchHit temp = heap[i];
+        heap[i] = heap[largest];
+        heap[largest] = temp;
+        i = largest;
+    }
+}
+
+/* Offer a hit to a bounded max-heap keeping the k best hits */
+static void search_heap_push(SearchHit *heap, int *count, int k, SearchHit hit) {
+    if (*count < k) {
+        int i = (*count)++;
+        heap[i] = hit;
+        while (i > 0 && search_hit_after(&heap[i], &heap[(i - 1) / 2])) {
+            SearchHit temp = heap[i];
+            heap[i] = heap[(i - 1) / 2];
+            heap[(i - 1) / 2] = temp;
+            i = (i - 1) / 2;
+        }
+    } else if (search_hit_after(&heap[0], &hit)) {
+        heap[0] = hit;
+        search_heap_sift_down(heap, *count, 0);
+    }
+}
+
+/* Shared state of a search */
+typedef struct SearchJob {
+    Space *space;
+    const void **queries;
+    int nq;
+    int k;
+    DistanceMethod method;
+    bool binary;
+    bool packed;
+    int rows_per_block;
+    int row_blocks;
+    int query_blocks;
+    int tiles;
+    _Atomic int next_tile;
+} SearchJob;
+
+/* Per-thread state of a search */
+typedef struct SearchWorker {
+    SearchJob *job;
+    SearchHit *heaps; // nq heaps of k hits
+    int *counts;
+    pthread_t thread;
+} SearchWorker;
+
+/* Process search tiles until none is left */
+static void *search_worker_run(void *arg) {
+    SearchWorker *worker = (SearchWorker *)arg;
+    SearchJob *job = worker->job;
+    Space *space = job->space;
+    int tile;
+    while ((tile = atomic_fetch_add(&job->next_tile, 1)) < job->tiles) {
+        int query_start = (tile % job->query_blocks) * SEARCH_QUERY_BLOCK;
+        int query_end = query_start + SEARCH_QUERY_BLOCK < job->nq ? query_start + SEARCH_QUERY_BLOCK : job->nq;
+        int row_start = (tile / job->query_blocks) * job->rows_per_block;
+        int row_end = row_start + job->rows_per_block < space->vector_count ? row_start + job->rows_per_block : space->vector_count;
+        for (int row = row_start; row < row_end; row++) {
+            const void *data = space_row(space, row);
+            for (int q = query_start; q < query_end; q++) {
+                SearchHit hit = { row_distance(job->queries[q], data, space->size, job->packed, job->binary, job->method), row };
+                search_heap_push(worker->heaps + (size_t)q * job->k, &worker->counts[q], job->k, hit);
             }
         }
-        return (double)count;
-    } else if (strcmp(method, "euclidean") == 0) {
-        double sum = 0.0;
-        for (int i = 0; i < vec1->size; i++) {
-            double diff = vec1->vector[i] - vec2->vector[i];
-            sum += diff * diff;
+    }
+    return NULL;
+}
+
+/* Find the k nearest vectors of a Space for each query
+ * Results of query q are written sorted by distance to out_ids[q * k .. q * k + k - 1]
+ * (space positions) and out_dists, padded with -1 and INFINITY when the space holds
+ * fewer than k vectors */
+void space_search(Space *space, Vector **queries, int nq, int k, const char *method, int *out_ids, double *out_dists) {
+    if (k <= 0) {
+        fprintf(stderr, "The number of neighbours must be greater than 0\n");
+        exit(EXIT_FAILURE);
+    }
+    if (nq <= 0) {
+        return;
+    }
+
+    SearchJob job;
+    job.space = space;
+    job.nq = nq;
+    job.k = k;
+    job.method = parse_distance_method(method);
+    job.binary = strcmp(space->vtype, "binary") == 0;
+    job.packed = space->dense ? space->packed : (space->vector_count > 0 && space->vectors[0]->packed);
+    for (int i = 0; i < space->vector_count && !space->dense; i++) {
+        if (space->vectors[i]->packed != job.packed) {
+            fprintf(stderr, "Space vectors must be all packed or all unpacked to be searched\n");
+            exit(EXIT_FAILURE);
         }
-        return sqrt(sum);
-    } else {
-        fprintf(stderr, "Distance method \"%s\" is not supported\n", method);
+    }
+    job.queries = (const void **)malloc(nq * sizeof(void *));
+    if (!job.queries) {
+        perror("Failed to allocate memory for search");
         exit(EXIT_FAILURE);
     }
+    for (int q = 0; q < nq; q++) {
+        Vector *query = queries[q];
+        if (query->size != space->size || strcmp(query->vtype, space->vtype) != 0) {
+            fprintf(stderr, "Query \"%s\" is not compatible with the space\n", query->name);
+            exit(EXIT_FAILURE);
+        }
+        if (space->vector_count > 0 && query->packed != job.packed) {
+            fprintf(stderr, "Query \"%s\" and space vectors must be both packed or both unpacked\n", query->name);
+            exit(EXIT_FAILURE);
+        }
+        job.queries[q] = query->packed ? (const void *)query->bits : (const void *)query->vector;
+    }
+
+    size_t row_bytes = job.packed ? PACKED_WORDS(space->size) * sizeof(uint64_t) : space->size * sizeof(int);
+    job.rows_per_block = (int)(SEARCH_BLOCK_BYTES / row_bytes) > 0 ? (int)(SEARCH_BLOCK_BYTES / row_bytes) : 1;
+    job.row_blocks = (space->vector_count + job.rows_per_block - 1) / job.rows_per_block;
+    job.query_blocks = (nq + SEARCH_QUERY_BLOCK - 1) / SEARCH_QUERY_BLOCK;
+    job.tiles = job.query_blocks * job.row_blocks;
+    atomic_init(&job.next_tile, 0);
+
+    int threads = space_threads > 0 ? space_threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > job.tiles) {
+        threads = job.tiles;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    SearchWorker *workers = (SearchWorker *)calloc(threads, sizeof(SearchWorker));
+    if (!workers) {
+        perror("Failed to allocate memory for search");
+        exit(EXIT_FAILURE);
+    }
+    for (int t = 0; t < threads; t++) {
+        workers[t].job = &job;
+        workers[t].heaps = (SearchHit *)malloc((size_t)nq * k * sizeof(SearchHit));
+        workers[t].counts = (int *)calloc(nq, sizeof(int));
+        if (!workers[t].heaps || !workers[t].counts) {
+            perror("Failed to allocate memory for search");
+            exit(EXIT_FAILURE);
+        }
+    }
+    space_advise(space, 0, space->vector_count, MADV_SEQUENTIAL);
+    for (int t = 1; t < threads; t++) {
+        if (pthread_create(&workers[t].thread, NULL, search_worker_run, &workers[t]) != 0) {
+            perror("Failed to start search thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    search_worker_run(&workers[0]);
+    for (int t = 1; t < threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+    }
+    space_advise(space, 0, space->vector_count, MADV_NORMAL);
+
+    /* Merge thread heaps into the first one and sort each heap in place */
+    for (int q = 0; q < nq; q++) {
+        SearchHit *heap = workers[0].heaps + (size_t)q * k;
+        int *count = &workers[0].counts[q];
+        for (int t = 1; t < threads; t++) {
+            for (int i = 0; i < workers[t].counts[q]; i++) {
+                search_heap_push(heap, count, k, workers[t].heaps[(size_t)q * k + i]);
+            }
+        }
+        for (int end = *count - 1; end > 0; end--) {
+            SearchHit temp = heap[0];
+            heap[0] = heap[end];
+            heap[end] = temp;
+            search_heap_sift_down(heap, end, 0);
+        }
+        for (int i = 0; i < k; i++) {
+            out_ids[(size_t)q * k + i] = i < *count ? heap[i].position : -1;
+            out_dists[(size_t)q * k + i] = i < *count ? heap[i].distance : INFINITY;
+        }
+    }
+
+    for (int t = 0; t < threads; t++) {
+        free(workers[t].heaps);
+        free(workers[t].counts);
+    }
+    free(workers);
+    free(job.queries);
 }
 
 /* Normalize a vector */
@@ -262,6 +1466,11 @@ void normalize_vector(Vector *vec) {
         exit(EXIT_FAILURE);
     }
 
+    /* Packed vectors are normalized by construction */
+    if (vec->packed) {
+        return;
+    }
+
     for (int i = 0; i < vec->size; i++) {
         if (vec->vector[i] > 0) {
             vec->vector[i] = 1;
@@ -277,9 +1486,24 @@ Vector *bind_vectors(Vector *vec1, Vector *vec2) {
         fprintf(stderr, "Vectors must have the same size\n");
         exit(EXIT_FAILURE);
     }
-    Vector *result = create_vector(vec1->name, vec1->size, vec1->vtype, -1, false);
+    if (vec1->packed && vec2->packed) {
+        /* XOR matches multiplication under the bipolar encoding and is the binary bind */
+        Vector *result = alloc_vector(vec1->name, vec1->size, vec1->vtype, true);
+        for (int i = 0; i < PACKED_WORDS(vec1->size); i++) {
+            result->bits[i] = vec1->bits[i] ^ vec2->bits[i];
+        }
+        return result;
+    }
+    Vector *result = alloc_vector(vec1->name, vec1->size, vec1->vtype, false);
+    if (strcmp(vec1->vtype, "binary") == 0) {
+        /* XOR as in the packed case, so packing never changes the result */
+        for (int i = 0; i < vec1->size; i++) {
+            result->vector[i] = vector_element(vec1, i) ^ vector_element(vec2, i);
+        }
+        return result;
+    }
     for (int i = 0; i < vec1->size; i++) {
-        result->vector[i] = vec1->vector[i] * vec2->vector[i];
+        result->vector[i] = vector_element(vec1, i) * vector_element(vec2, i);
     }
     return result;
 }
@@ -290,9 +1514,9 @@ Vector *bundle_vectors(Vector *vec1, Vector *vec2) {
         fprintf(stderr, "Vectors must have the same size\n");
         exit(EXIT_FAILURE);
     }
-    Vector *result = create_vector(vec1->name, vec1->size, vec1->vtype, -1, false);
+    Vector *result = alloc_vector(vec1->name, vec1->size, vec1->vtype, false);
     for (int i = 0; i < vec1->size; i++) {
-        result->vector[i] = vec1->vector[i] + vec2->vector[i];
+        result->vector[i] = vector_element(vec1, i) + vector_element(vec2, i);
     }
     return result;
 }
@@ -303,25 +1527,41 @@ Vector *subtract_vectors(Vector *vec1, Vector *vec2) {
         fprintf(stderr, "Vectors must have the same size\n");
         exit(EXIT_FAILURE);
     }
-    Vector *result = create_vector(vec1->name, vec1->size, vec1->vtype, -1, false);
+    Vector *result = alloc_vector(vec1->name, vec1->size, vec1->vtype, false);
     for (int i = 0; i < vec1->size; i++) {
-        result->vector[i] = vec1->vector[i] - vec2->vector[i];
+        result->vector[i] = vector_element(vec1, i) - vector_element(vec2, i);
     }
     return result;
 }
 
+/* Reverse count elements in place */
+static void reverse_elements(int *elements, int count) {
+    for (int i = 0, j = count - 1; i < j; i++, j--) {
+        int temp = elements[i];
+        elements[i] = elements[j];
+        elements[j] = temp;
+    }
+}
+
 /* Permute a vector */
 void permute_vector(Vector *vec, int rotate_by) {
-    int *temp = (int *)malloc(vec->size * sizeof(int));
-    if (!temp) {
-        perror("Failed to allocate memory for permutation");
-        exit(EXIT_FAILURE);
-    }
-    for (int i = 0; i < vec->size; i++) {
-        temp[(i + rotate_by) % vec->size] = vec->vector[i];
+    if (vec->packed) {
+        uint64_t *rotated = (uint64_t *)malloc(PACKED_WORDS(vec->size) * sizeof(uint64_t));
+        if (!rotated) {
+            perror("Failed to allocate memory for permutation");
+            exit(EXIT_FAILURE);
+        }
+        packed_rotate(rotated, vec->bits, vec->size, rotate_by);
+        memcpy(vec->bits, rotated, PACKED_WORDS(vec->size) * sizeof(uint64_t));
+        free(rotated);
+        return;
     }
-    memcpy(vec->vector, temp, vec->size * sizeof(int));
-    free(temp);
+    /* Rotate in place by reversing both segments and then the whole vector */
+    int shift = ((rotate_by % vec->size) + vec->size) % vec->size;
+    int tail = vec->size - shift;
+    reverse_elements(vec->vector, tail);
+    reverse_elements(vec->vector + tail, shift);
+    reverse_elements(vec->vector, vec->size);
 }
 
 /* Example usage */
@@ -338,6 +1578,12 @@ int main() {
     double dist = vector_distance(vec1, vec2, "cosine");
     printf("Cosine distance between vec1 and vec2: %f\n", dist);
 
+    /* Pack vectors to 1 bit per dimension */
+    pack_vector(vec1);
+    pack_vector(vec2);
+    dist = vector_distance(vec1, vec2, "cosine");
+    printf("Cosine distance between packed vec1 and vec2: %f\n", dist);
+
     /* Bind vectors */
     Vector *bound_vec = bind_vectors(vec1, vec2);
     /* Normalize the bound vector */
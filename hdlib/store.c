@@ -0,0 +1,1066 @@
+/* Implementation of the binary file format of Space, MLModel, Graph and Dataset in C */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Assuming the Vector, Space, MLModel and Graph structures and functions are defined as in previous implementations */
+/* Include the definitions of Vector, Space, MLModel and Graph here or in a separate header file */
+
+/* Define the Dataset structure, as in parser.c */
+typedef struct Dataset {
+    int num_samples;
+    int num_features;
+    char **samples; // sample ids
+    char **features; // feature names
+    double **content; // row pointers into values
+    double *values; // num_samples rows of num_features values
+    char **classes; // label of each sample, NULL if its line has none
+    int *labels; // index of the label of each sample in class_names, -1 if none
+    char **class_names; // distinct labels in order of first appearance
+    int classes_count;
+    void *mapping; // file holding values and labels when loaded with load_dataset_cache
+    size_t mapping_length;
+} Dataset;
+
+/* File layout
+ * A fixed size header with a table of sections, followed by the sections, each starting
+ * at a multiple of STORE_ALIGNMENT bytes. All values are stored in the byte order of the
+ * machine that wrote the file, which is checked on load. The vector matrix is stored as
+ * the rows of a dense Space, so a loaded Space uses it in place from the mapping; only
+ * the Vector headers, with their names and tags, are built at load time.
+ *
+ * An out-of-core Space keeps the file mapped shared and writable: its rows are read
+ * and written through the page cache and appended rows grow the file after the matrix.
+ * The tables that followed the matrix are then rewritten after the last row when the
+ * Space is synced, so the file stays in this format. */
+
+#define STORE_MAGIC "HDLIBC\r\n"
+#define STORE_VERSION 1
+#define STORE_ALIGNMENT 64
+#define STORE_MAX_SECTIONS 24
+#define STORE_BYTE_ORDER 0x01020304u
+
+/* Kinds of stored objects */
+typedef enum StoreKind {
+    STORE_SPACE = 1,
+    STORE_MLMODEL = 2,
+    STORE_GRAPH = 3,
+    STORE_DATASET = 4
+} StoreKind;
+
+/* Section identifiers */
+typedef enum StoreSectionId {
+    SECTION_SPACE = 1, // StoredSpace
+    SECTION_MATRIX, // vector_count rows of row_stride bytes
+    SECTION_VECTORS, // one StoredVector per vector
+    SECTION_STRINGS, // NUL-terminated strings referenced by offset
+    SECTION_TAGS, // uint64_t string offsets: space tags first, then vector tags
+    SECTION_INDEX, // int32_t name index of index_capacity slots
+    SECTION_HASHES, // uint64_t hash of each vector name
+    SECTION_MODEL, // StoredModel
+    SECTION_MODEL_CLASSES, // uint64_t string offset of each class
+    SECTION_MODEL_ACCUMULATORS, // StoredAccumulator of each class
+    SECTION_MODEL_PROTOTYPES, // classes_count rows of size int32_t counts
+    SECTION_MODEL_BOUNDS, // min_values then max_values, num_features doubles each
+    SECTION_MODEL_EDGES, // num_features rows of levels-1 double bin edges
+    SECTION_MODEL_LEVELS, // int32_t space position of each level vector
+    SECTION_MODEL_POINTS, // StoredPoint of each point
+    SECTION_MODEL_SELECTED, // uint8_t per feature, only after a stepwise selection
+    SECTION_GRAPH, // StoredGraph
+    SECTION_DATASET, // StoredDataset
+    SECTION_DATASET_VALUES, // num_samples rows of num_features doubles
+    SECTION_DATASET_LABELS, // int32_t class of each sample, -1 when unlabeled
+    SECTION_DATASET_SAMPLES, // uint64_t string offset of each sample id
+    SECTION_DATASET_FEATURES, // uint64_t string offset of each feature name
+    SECTION_DATASET_CLASSES // uint64_t string offset of each class
+} StoreSectionId;
+
+typedef struct StoreSection {
+    uint32_t id;
+    uint32_t reserved;
+    uint64_t offset; // from the start of the file
+    uint64_t length; // in bytes
+} StoreSection;
+
+typedef struct StoreHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t kind;
+    uint32_t byte_order;
+    uint32_t section_count;
+    uint64_t file_length;
+    StoreSection sections[STORE_MAX_SECTIONS];
+} StoreHeader;
+
+typedef struct StoredSpace {
+    int32_t size;
+    int32_t vector_count;
+    uint32_t binary;
+    uint32_t packed;
+    uint64_t row_stride;
+    int32_t index_capacity;
+    int32_t tags_count;
+} StoredSpace;
+
+typedef struct StoredVector {
+    uint64_t name; // string offset
+    uint64_t tags; // first entry in the tags section
+    uint32_t tags_count;
+    int32_t seed;
+    uint32_t warning;
+    uint32_t reserved;
+} StoredVector;
+
+typedef struct StoredModel {
+    int32_t size;
+    int32_t levels;
+    int32_t threads;
+    int32_t max_iterations;
+    int32_t binning;
+    int32_t num_features;
+    int32_t classes_count;
+    int32_t num_points;
+} StoredModel;
+
+typedef struct StoredAccumulator {
+    int64_t bound;
+    int64_t count;
+} StoredAccumulator;
+
+typedef struct StoredPoint {
+    int32_t position; // in the space
+    int32_t class_idx; // -1 when unlabeled
+    uint32_t trained;
+    uint32_t reserved;
+} StoredPoint;
+
+typedef struct StoredGraph {
+    int32_t size;
+    uint32_t directed;
+    uint32_t weighted;
+    int32_t nodes_counter;
+    int32_t edges_counter;
+    int32_t seed;
+} StoredGraph;
+
+typedef struct StoredDataset {
+    int32_t num_samples;
+    int32_t num_features;
+    int32_t classes_count;
+    uint32_t reserved;
+    uint64_t source_length; // size of the text file it was converted from, 0 if unknown
+    int64_t source_mtime; // modification time of that file in nanoseconds
+} StoredDataset;
+
+/* Growable byte buffer used to build the string and tag tables */
+typedef struct StoreBuffer {
+    char *data;
+    size_t length;
+    size_t capacity;
+} StoreBuffer;
+
+/* File being written, with its header filled in as sections are appended */
+typedef struct StoreWriter {
+    FILE *file;
+    const char *path;
+    StoreHeader header;
+    uint64_t offset;
+    StoreBuffer strings;
+    StoreBuffer tags;
+} StoreWriter;
+
+/* Function prototypes */
+void save_space(Space *space, const char *path);
+Space *load_space(const char *path);
+Space *open_space(const char *path);
+Space *create_file_space(const char *path, int size, const char *vtype, bool packed);
+void sync_space(Space *space);
+void save_mlmodel(MLModel *model, const char *path);
+MLModel *load_mlmodel(const char *path);
+void save_graph(Graph *graph, const char *path);
+Graph *load_graph(const char *path);
+void save_dataset_cache(Dataset *dataset, const char *path);
+Dataset *load_dataset_cache(const char *path);
+Dataset *open_dataset_cached(const char *filepath, const char *sep, const char *cache_path);
+
+/* Helper functions */
+Dataset *open_dataset(const char *filepath, const char *sep);
+void close_dataset(Dataset *dataset);
+
+/* Function implementations */
+
+/* Append bytes to a buffer and return the offset they were written at */
+static uint64_t store_buffer_append(StoreBuffer *buffer, const void *data, size_t length) {
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+        while (capacity < buffer->length + length) {
+            capacity *= 2;
+        }
+        buffer->data = (char *)realloc(buffer->data, capacity);
+        if (!buffer->data) {
+            perror("Failed to allocate memory for store buffer");
+            exit(EXIT_FAILURE);
+        }
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    uint64_t offset = buffer->length;
+    buffer->length += length;
+    return offset;
+}
+
+/* Add a string to the string table and return its offset */
+static uint64_t store_string(StoreWriter *writer, const char *str) {
+    return store_buffer_append(&writer->strings, str, strlen(str) + 1);
+}
+
+/* Add a string offset to the tag table and return its entry */
+static uint64_t store_tag(StoreWriter *writer, const char *tag) {
+    uint64_t offset = store_string(writer, tag);
+    return store_buffer_append(&writer->tags, &offset, sizeof(offset)) / sizeof(uint64_t);
+}
+
+/* Start writing sections of a file at an offset past the header */
+static void store_writer_init(StoreWriter *writer, FILE *file, const char *path, StoreKind kind, uint64_t offset) {
+    memset(writer, 0, sizeof(*writer));
+    writer->path = path;
+    writer->file = file;
+    memcpy(writer->header.magic, STORE_MAGIC, sizeof(writer->header.magic));
+    writer->header.version = STORE_VERSION;
+    writer->header.kind = kind;
+    writer->header.byte_order = STORE_BYTE_ORDER;
+    writer->offset = offset;
+    if (fseeko(writer->file, (off_t)writer->offset, SEEK_SET) != 0) {
+        perror("Failed to write file");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Open a file for writing and reserve room for the header */
+static void store_writer_open(StoreWriter *writer, const char *path, StoreKind kind) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        perror("Failed to open file for writing");
+        exit(EXIT_FAILURE);
+    }
+    store_writer_init(writer, file, path, kind, (sizeof(StoreHeader) + STORE_ALIGNMENT - 1) / STORE_ALIGNMENT * STORE_ALIGNMENT);
+}
+
+/* Start a section at the next aligned offset */
+static void store_begin_section(StoreWriter *writer, StoreSectionId id) {
+    if (writer->header.section_count == STORE_MAX_SECTIONS) {
+        fprintf(stderr, "Too many sections in %s\n", writer->path);
+        exit(EXIT_FAILURE);
+    }
+    static const char padding[STORE_ALIGNMENT] = {0};
+    size_t pad = (STORE_ALIGNMENT - writer->offset % STORE_ALIGNMENT) % STORE_ALIGNMENT;
+    if (pad > 0 && fwrite(padding, 1, pad, writer->file) != pad) {
+        perror("Failed to write file");
+        exit(EXIT_FAILURE);
+    }
+    writer->offset += pad;
+    StoreSection *section = &writer->header.sections[writer->header.section_count++];
+    section->id = id;
+    section->offset = writer->offset;
+    section->length = 0;
+}
+
+/* Append bytes to the current section */
+static void store_write(StoreWriter *writer, const void *data, size_t length) {
+    if (length > 0 && fwrite(data, 1, length, writer->file) != length) {
+        perror("Failed to write file");
+        exit(EXIT_FAILURE);
+    }
+    writer->offset += length;
+    writer->header.sections[writer->header.section_count - 1].length += length;
+}
+
+/* Write a whole section */
+static void store_section(StoreWriter *writer, StoreSectionId id, const void *data, size_t length) {
+    store_begin_section(writer, id);
+    store_write(writer, data, length);
+}
+
+/* Write the string and tag tables and the header, then close the file */
+static void store_writer_close(StoreWriter *writer) {
+    store_section(writer, SECTION_STRINGS, writer->strings.data, writer->strings.length);
+    store_section(writer, SECTION_TAGS, writer->tags.data, writer->tags.length);
+    writer->header.file_length = writer->offset;
+    if (fseek(writer->file, 0, SEEK_SET) != 0 || fwrite(&writer->header, sizeof(StoreHeader), 1, writer->file) != 1) {
+        perror("Failed to write file");
+        exit(EXIT_FAILURE);
+    }
+    if (fclose(writer->file) != 0) {
+        perror("Failed to write file");
+        exit(EXIT_FAILURE);
+    }
+    free(writer->strings.data);
+    free(writer->tags.data);
+}
+
+/* Bytes of a matrix row, and the row stride, of a Space stored with or without packing */
+static size_t store_row_bytes(Space *space, bool packed, size_t *row_stride) {
+    size_t row_bytes = packed ? PACKED_WORDS(space->size) * sizeof(uint64_t) : space->size * sizeof(int);
+    *row_stride = (row_bytes + STORE_ALIGNMENT - 1) / STORE_ALIGNMENT * STORE_ALIGNMENT;
+    return row_bytes;
+}
+
+/* Write the description of a Space and its own tags */
+static void store_write_space_info(StoreWriter *writer, Space *space, bool packed) {
+    size_t row_stride;
+    store_row_bytes(space, packed, &row_stride);
+    StoredSpace stored;
+    memset(&stored, 0, sizeof(stored));
+    stored.size = space->size;
+    stored.vector_count = space->vector_count;
+    stored.binary = strcmp(space->vtype, "binary") == 0;
+    stored.packed = packed;
+    stored.row_stride = row_stride;
+    stored.index_capacity = space->index_capacity;
+    stored.tags_count = space->tags_count;
+    store_section(writer, SECTION_SPACE, &stored, sizeof(stored));
+    for (int i = 0; i < space->tags_count; i++) {
+        store_tag(writer, space->tags[i]);
+    }
+}
+
+/* Write the matrix rows, zero padded to the row stride */
+static void store_write_matrix(StoreWriter *writer, Space *space, bool packed) {
+    bool binary = strcmp(space->vtype, "binary") == 0;
+    size_t row_stride;
+    size_t row_bytes = store_row_bytes(space, packed, &row_stride);
+    char *row = (char *)calloc(1, row_stride);
+    if (!row) {
+        perror("Failed to allocate memory for matrix row");
+        exit(EXIT_FAILURE);
+    }
+    store_begin_section(writer, SECTION_MATRIX);
+    for (int position = 0; position < space->vector_count; position++) {
+        Vector *vec = space->vectors[position];
+        if (vec->packed == packed) {
+            memcpy(row, packed ? (void *)vec->bits : (void *)vec->vector, row_bytes);
+        } else {
+            // Mixed non-dense space: expand packed vectors to elements
+            int *elements = (int *)row;
+            for (int i = 0; i < vec->size; i++) {
+                int bit = (int)((vec->bits[i / 64] >> (i % 64)) & 1);
+                elements[i] = binary ? bit : (bit ? -1 : 1);
+            }
+        }
+        store_write(writer, row, row_stride);
+    }
+    free(row);
+}
+
+/* Write the vector headers, name index and name hashes of a Space */
+static void store_write_space_tables(StoreWriter *writer, Space *space) {
+    store_begin_section(writer, SECTION_VECTORS);
+    for (int position = 0; position < space->vector_count; position++) {
+        Vector *vec = space->vectors[position];
+        StoredVector header;
+        memset(&header, 0, sizeof(header));
+        header.name = store_string(writer, vec->name);
+        header.tags = writer->tags.length / sizeof(uint64_t);
+        header.tags_count = vec->tags_count;
+        header.seed = vec->seed;
+        header.warning = vec->warning;
+        for (int i = 0; i < vec->tags_count; i++) {
+            store_tag(writer, vec->tags[i]);
+        }
+        store_write(writer, &header, sizeof(header));
+    }
+    store_section(writer, SECTION_INDEX, space->index, (size_t)space->index_capacity * sizeof(int32_t));
+    store_section(writer, SECTION_HASHES, space->name_hashes, (size_t)space->vector_count * sizeof(uint64_t));
+}
+
+/* Write the sections of a Space */
+static void store_write_space(StoreWriter *writer, Space *space) {
+    // Dense spaces keep their layout, others are packed only if all their vectors are
+    bool packed = space->dense ? space->packed : space->vector_count > 0;
+    for (int i = 0; !space->dense && i < space->vector_count; i++) {
+        packed = packed && space->vectors[i]->packed;
+    }
+    store_write_space_info(writer, space, packed);
+    store_write_matrix(writer, space, packed);
+    store_write_space_tables(writer, space);
+}
+
+/* Save a Space to a binary file */
+void save_space(Space *space, const char *path) {
+    StoreWriter writer;
+    store_writer_open(&writer, path, STORE_SPACE);
+    store_write_space(&writer, space);
+    store_writer_close(&writer);
+}
+
+/* Find a section of a mapped file, NULL if it is missing */
+static void *store_find(void *mapping, StoreSectionId id, uint64_t *length) {
+    StoreHeader *header = (StoreHeader *)mapping;
+    for (uint32_t i = 0; i < header->section_count; i++) {
+        if (header->sections[i].id == id) {
+            if (length) {
+                *length = header->sections[i].length;
+            }
+            return (char *)mapping + header->sections[i].offset;
+        }
+    }
+    return NULL;
+}
+
+/* Find a section that must be present with at least a minimum length */
+static void *store_require(void *mapping, StoreSectionId id, uint64_t min_length, const char *path) {
+    uint64_t length = 0;
+    void *section = store_find(mapping, id, &length);
+    if (!section || length < min_length) {
+        fprintf(stderr, "Missing or truncated section %d in %s\n", (int)id, path);
+        exit(EXIT_FAILURE);
+    }
+    return section;
+}
+
+/* Map a file and check its header; a shared mapping is writable through to the file,
+ * whose descriptor is then kept open in fd */
+static void *store_map(const char *path, StoreKind kind, bool shared, size_t *mapping_length, int *fd_out) {
+    int fd = open(path, shared ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+        perror("Failed to open file");
+        exit(EXIT_FAILURE);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror("Failed to stat file");
+        exit(EXIT_FAILURE);
+    }
+    if ((size_t)st.st_size < sizeof(StoreHeader)) {
+        fprintf(stderr, "%s is not an hdlib file\n", path);
+        exit(EXIT_FAILURE);
+    }
+    /* Private pages can be modified in memory without touching the file, shared ones write through */
+    void *mapping = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    if (shared) {
+        *fd_out = fd;
+    } else {
+        close(fd);
+    }
+    if (mapping == MAP_FAILED) {
+        perror("Failed to map file");
+        exit(EXIT_FAILURE);
+    }
+    StoreHeader *header = (StoreHeader *)mapping;
+    if (memcmp(header->magic, STORE_MAGIC, sizeof(header->magic)) != 0) {
+        fprintf(stderr, "%s is not an hdlib file\n", path);
+        exit(EXIT_FAILURE);
+    }
+    if (header->byte_order != STORE_BYTE_ORDER) {
+        fprintf(stderr, "%s was written on a machine with a different byte order\n", path);
+        exit(EXIT_FAILURE);
+    }
+    if (header->version != STORE_VERSION) {
+        fprintf(stderr, "%s has unsupported format version %u\n", path, header->version);
+        exit(EXIT_FAILURE);
+    }
+    if (header->kind != (uint32_t)kind) {
+        fprintf(stderr, "%s does not hold the expected kind of object\n", path);
+        exit(EXIT_FAILURE);
+    }
+    if (header->file_length != (uint64_t)st.st_size || header->section_count > STORE_MAX_SECTIONS) {
+        fprintf(stderr, "%s is truncated or corrupted\n", path);
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < header->section_count; i++) {
+        StoreSection *section = &header->sections[i];
+        if (section->offset % STORE_ALIGNMENT != 0 || section->offset > header->file_length ||
+            section->length > header->file_length - section->offset) {
+            fprintf(stderr, "%s is truncated or corrupted\n", path);
+            exit(EXIT_FAILURE);
+        }
+    }
+    *mapping_length = st.st_size;
+    return mapping;
+}
+
+/* Copy count tags stored as offsets into the string section, NULL if there are none */
+static char **store_copy_tags(const char *strings, const uint64_t *offsets, int count) {
+    if (count <= 0) {
+        return NULL;
+    }
+    char **tags = (char **)malloc(count * sizeof(char *));
+    if (!tags) {
+        perror("Failed to allocate memory for tags");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < count; i++) {
+        tags[i] = strdup(strings + offsets[i]);
+    }
+    return tags;
+}
+
+/* Build a dense Space over the sections of a mapped file; the Space owns the mapping */
+static Space *store_open_space(void *mapping, size_t mapping_length, const char *path) {
+    StoredSpace *stored = (StoredSpace *)store_require(mapping, SECTION_SPACE, sizeof(StoredSpace), path);
+    int count = stored->vector_count;
+    Space *space = create_dense_space(stored->size, stored->binary ? "binary" : "bipolar", stored->packed);
+    if (space->row_stride != stored->row_stride || count < 0 ||
+        stored->index_capacity < (count > 0 ? 2 * count : 0) || (stored->index_capacity & (stored->index_capacity - 1)) != 0) {
+        fprintf(stderr, "%s is truncated or corrupted\n", path);
+        exit(EXIT_FAILURE);
+    }
+    uint64_t strings_length = 0;
+    uint64_t tags_length = 0;
+    char *strings = (char *)store_require(mapping, SECTION_STRINGS, 0, path);
+    store_find(mapping, SECTION_STRINGS, &strings_length);
+    uint64_t *tags = (uint64_t *)store_require(mapping, SECTION_TAGS, 0, path);
+    store_find(mapping, SECTION_TAGS, &tags_length);
+    StoredVector *headers = (StoredVector *)store_require(mapping, SECTION_VECTORS, (uint64_t)count * sizeof(StoredVector), path);
+
+    space->mapping = mapping;
+    space->mapping_length = mapping_length;
+    space->matrix = store_require(mapping, SECTION_MATRIX, (uint64_t)count * space->row_stride, path);
+    space->index = (int *)store_require(mapping, SECTION_INDEX, (uint64_t)stored->index_capacity * sizeof(int32_t), path);
+    space->index_capacity = stored->index_capacity;
+    space->name_hashes = (uint64_t *)store_require(mapping, SECTION_HASHES, (uint64_t)count * sizeof(uint64_t), path);
+    if (count == 0) {
+        // Empty sections may sit at the end of the mapping, where they would pass for heap
+        space->matrix = NULL;
+        space->name_hashes = NULL;
+    }
+    if (space->index_capacity == 0) {
+        space->index = NULL;
+    }
+
+    // Vectors own their headers, names and tags like those of any dense Space, so they
+    // can be freed, renamed and retagged; only their elements stay in the mapping
+    uint64_t tag_entries = tags_length / sizeof(uint64_t);
+    if (strings_length > 0 && strings[strings_length - 1] != '\0') {
+        fprintf(stderr, "%s is truncated or corrupted\n", path);
+        exit(EXIT_FAILURE);
+    }
+    for (uint64_t i = 0; i < tag_entries; i++) {
+        if (tags[i] >= strings_length) {
+            fprintf(stderr, "%s is truncated or corrupted\n", path);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if ((uint64_t)stored->tags_count > tag_entries) {
+        fprintf(stderr, "%s is truncated or corrupted\n", path);
+        exit(EXIT_FAILURE);
+    }
+    space->vectors = (Vector **)malloc((count ? count : 1) * sizeof(Vector *));
+    if (!space->vectors) {
+        perror("Failed to allocate memory for loaded vectors");
+        exit(EXIT_FAILURE);
+    }
+    space->tags = store_copy_tags(strings, tags, stored->tags_count);
+    space->tags_count = stored->tags_count;
+    for (int position = 0; position < count; position++) {
+        StoredVector *header = &headers[position];
+        if (header->name >= strings_length || header->tags + header->tags_count > tag_entries) {
+            fprintf(stderr, "%s is truncated or corrupted\n", path);
+            exit(EXIT_FAILURE);
+        }
+        Vector *vec = (Vector *)malloc(sizeof(Vector));
+        if (!vec) {
+            perror("Failed to allocate memory for loaded vectors");
+            exit(EXIT_FAILURE);
+        }
+        vec->name = strdup(strings + header->name);
+        vec->size = space->size;
+        vec->packed = space->packed;
+        vec->borrowed = true;
+        vec->vector = space->packed ? NULL : (int *)space_row(space, position);
+        vec->bits = space->packed ? (uint64_t *)space_row(space, position) : NULL;
+        vec->vtype = strdup(space->vtype);
+        vec->tags = store_copy_tags(strings, tags + header->tags, header->tags_count);
+        vec->tags_count = header->tags_count;
+        vec->seed = header->seed;
+        vec->warning = header->warning;
+        space->vectors[position] = vec;
+    }
+    space->vector_count = count;
+    space->capacity = count;
+    space->mapped_count = count;
+    return space;
+}
+
+/* Load a Space saved with save_space; vector elements are used in place from the mapped
+ * file. The Space is dense and accepts new vectors */
+Space *load_space(const char *path) {
+    size_t mapping_length;
+    void *mapping = store_map(path, STORE_SPACE, false, &mapping_length, NULL);
+    return store_open_space(mapping, mapping_length, path);
+}
+
+/* Open a Space saved with save_space as an out-of-core Space: only the vector headers
+ * are read up front, elements are paged in from the file on access and changes to them
+ * are written to it. Inserted vectors are appended to the file; free_space or sync_space
+ * make the file complete again, and only then write back renamed or retagged vectors */
+Space *open_space(const char *path) {
+    size_t mapping_length;
+    int fd = -1;
+    void *mapping = store_map(path, STORE_SPACE, true, &mapping_length, &fd);
+    Space *space = store_open_space(mapping, mapping_length, path);
+    space->fd = fd;
+    space->sync = sync_space;
+    space->matrix_offset = (size_t)((char *)store_find(mapping, SECTION_MATRIX, NULL) - (char *)mapping);
+    return space;
+}
+
+/* Create an empty out-of-core Space in a new file, see open_space */
+Space *create_file_space(const char *path, int size, const char *vtype, bool packed) {
+    Space *space = create_dense_space(size, vtype, packed);
+    save_space(space, path);
+    free_space(space);
+    return open_space(path);
+}
+
+/* Write the tables of an out-of-core Space after its rows and flush its file */
+void sync_space(Space *space) {
+    if (space->fd < 0) {
+        fprintf(stderr, "Space is not backed by a file\n");
+        exit(EXIT_FAILURE);
+    }
+    if (msync(space->mapping, space->mapping_length, MS_SYNC) != 0) {
+        perror("Failed to write space file");
+        exit(EXIT_FAILURE);
+    }
+    if (space->vector_count == space->mapped_count) {
+        // Nothing was appended, the tables in the file are still current
+        return;
+    }
+    int fd = dup(space->fd);
+    FILE *file = fd >= 0 ? fdopen(fd, "r+b") : NULL;
+    if (!file) {
+        perror("Failed to open space file");
+        exit(EXIT_FAILURE);
+    }
+    // Appending moved the tables into the heap, the old ones are overwritten
+    StoreWriter writer;
+    store_writer_init(&writer, file, "space file", STORE_SPACE, space->matrix_offset + (uint64_t)space->capacity * space->row_stride);
+    store_write_space_info(&writer, space, space->packed);
+    StoreSection *matrix = &writer.header.sections[writer.header.section_count++];
+    matrix->id = SECTION_MATRIX;
+    matrix->offset = space->matrix_offset;
+    matrix->length = (uint64_t)space->vector_count * space->row_stride;
+    store_write_space_tables(&writer, space);
+    store_writer_close(&writer);
+    if (ftruncate(space->fd, (off_t)writer.header.file_length) != 0 || fsync(space->fd) != 0) {
+        perror("Failed to write space file");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Save an MLModel, including its space and class prototypes, to a binary file */
+void save_mlmodel(MLModel *model, const char *path) {
+    StoreWriter writer;
+    store_writer_open(&writer, path, STORE_MLMODEL);
+    store_write_space(&writer, model->space);
+
+    StoredModel stored;
+    memset(&stored, 0, sizeof(stored));
+    stored.size = model->size;
+    stored.levels = model->levels;
+    stored.threads = model->threads;
+    stored.max_iterations = model->max_iterations;
+    stored.binning = model->binning;
+    stored.num_features = model->level_vectors ? model->num_features : 0;
+    stored.classes_count = model->class_accumulators ? model->classes_count : 0;
+    stored.num_points = model->point_vectors ? model->num_points : 0;
+    store_section(&writer, SECTION_MODEL, &stored, sizeof(stored));
+
+    store_begin_section(&writer, SECTION_MODEL_CLASSES);
+    for (int i = 0; i < stored.classes_count; i++) {
+        uint64_t offset = store_string(&writer, model->classes[i]);
+        store_write(&writer, &offset, sizeof(offset));
+    }
+    store_begin_section(&writer, SECTION_MODEL_ACCUMULATORS);
+    for (int i = 0; i < stored.classes_count; i++) {
+        StoredAccumulator acc;
+        acc.bound = model->class_accumulators[i].bound;
+        acc.count = model->class_accumulators[i].count;
+        store_write(&writer, &acc, sizeof(acc));
+    }
+    store_begin_section(&writer, SECTION_MODEL_PROTOTYPES);
+    if (stored.classes_count > 0) {
+        Vector *counts = alloc_vector("counts", model->size, model->vtype, false);
+        for (int i = 0; i < stored.classes_count; i++) {
+            bundle_accumulator_counts(&model->class_accumulators[i], counts);
+            store_write(&writer, counts->vector, model->size * sizeof(int32_t));
+        }
+        free_vector(counts);
+    }
+    if (stored.num_features > 0) {
+        store_begin_section(&writer, SECTION_MODEL_BOUNDS);
+        store_write(&writer, model->min_values, stored.num_features * sizeof(double));
+        store_write(&writer, model->max_values, stored.num_features * sizeof(double));
+        if (model->bin_edges) {
+            store_section(&writer, SECTION_MODEL_EDGES, model->bin_edges, (size_t)stored.num_features * (model->levels - 1) * sizeof(double));
+        }
+        store_begin_section(&writer, SECTION_MODEL_LEVELS);
+        for (int level = 0; level < model->levels; level++) {
+            int32_t position = space_vector_position(model->space, model->level_vectors[level]->name);
+            store_write(&writer, &position, sizeof(position));
+        }
+        if (model->selected_features) {
+            store_begin_section(&writer, SECTION_MODEL_SELECTED);
+            for (int i = 0; i < stored.num_features; i++) {
+                uint8_t selected = model->selected_features[i];
+                store_write(&writer, &selected, sizeof(selected));
+            }
+        }
+    }
+    store_begin_section(&writer, SECTION_MODEL_POINTS);
+    for (int i = 0; i < stored.num_points; i++) {
+        StoredPoint point;
+        memset(&point, 0, sizeof(point));
+        point.position = space_vector_position(model->space, model->point_vectors[i]->name);
+        point.class_idx = model->point_classes[i];
+        point.trained = model->point_trained[i];
+        store_write(&writer, &point, sizeof(point));
+    }
+    store_writer_close(&writer);
+}
+
+/* Copy a section of doubles into a new heap array */
+static double *store_copy_doubles(const double *values, size_t count) {
+    double *copy = (double *)malloc(count * sizeof(double));
+    if (!copy) {
+        perror("Failed to allocate memory for model");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(copy, values, count * sizeof(double));
+    return copy;
+}
+
+/* Load an MLModel saved with save_mlmodel; its space is loaded in place as with load_space
+ * and only the per class and per feature metadata are copied */
+MLModel *load_mlmodel(const char *path) {
+    size_t mapping_length;
+    void *mapping = store_map(path, STORE_MLMODEL, false, &mapping_length, NULL);
+    StoredModel *stored = (StoredModel *)store_require(mapping, SECTION_MODEL, sizeof(StoredModel), path);
+    StoredSpace *stored_space = (StoredSpace *)store_require(mapping, SECTION_SPACE, sizeof(StoredSpace), path);
+    int vector_count = stored_space->vector_count;
+    char *strings = (char *)store_require(mapping, SECTION_STRINGS, 0, path);
+    uint64_t strings_length = 0;
+    store_find(mapping, SECTION_STRINGS, &strings_length);
+
+    MLModel *model = create_mlmodel(stored->size, stored->levels, stored_space->binary ? "binary" : "bipolar");
+    free_space(model->space);
+    model->space = store_open_space(mapping, mapping_length, path);
+    model->threads = stored->threads;
+    model->max_iterations = stored->max_iterations;
+    model->binning = (Binning)stored->binning;
+
+    if (stored->num_features > 0) {
+        int features = stored->num_features;
+        double *bounds = (double *)store_require(mapping, SECTION_MODEL_BOUNDS, 2 * (uint64_t)features * sizeof(double), path);
+        model->num_features = features;
+        model->min_values = store_copy_doubles(bounds, features);
+        model->max_values = store_copy_doubles(bounds + features, features);
+        double *edges = (double *)store_find(mapping, SECTION_MODEL_EDGES, NULL);
+        if (edges) {
+            store_require(mapping, SECTION_MODEL_EDGES, (uint64_t)features * (model->levels - 1) * sizeof(double), path);
+            model->bin_edges = store_copy_doubles(edges, (size_t)features * (model->levels - 1));
+        }
+        int32_t *levels = (int32_t *)store_require(mapping, SECTION_MODEL_LEVELS, (uint64_t)model->levels * sizeof(int32_t), path);
+        model->level_vectors = (Vector **)malloc(model->levels * sizeof(Vector *));
+        if (!model->level_vectors) {
+            perror("Failed to allocate memory for level vectors");
+            exit(EXIT_FAILURE);
+        }
+        for (int level = 0; level < model->levels; level++) {
+            if (levels[level] < 0 || levels[level] >= vector_count) {
+                fprintf(stderr, "%s is truncated or corrupted\n", path);
+                exit(EXIT_FAILURE);
+            }
+            model->level_vectors[level] = model->space->vectors[levels[level]];
+        }
+        uint8_t *selected = (uint8_t *)store_find(mapping, SECTION_MODEL_SELECTED, NULL);
+        if (selected) {
+            store_require(mapping, SECTION_MODEL_SELECTED, features, path);
+            model->selected_features = (bool *)malloc(features * sizeof(bool));
+            if (!model->selected_features) {
+                perror("Failed to allocate memory for model");
+                exit(EXIT_FAILURE);
+            }
+            for (int i = 0; i < features; i++) {
+                model->selected_features[i] = selected[i] != 0;
+            }
+        }
+    }
+
+    int classes = stored->classes_count;
+    int num_points = stored->num_points;
+    StoredPoint *points = (StoredPoint *)store_require(mapping, SECTION_MODEL_POINTS, (uint64_t)num_points * sizeof(StoredPoint), path);
+    if (num_points > 0) {
+        model->num_points = num_points;
+        model->point_vectors = (Vector **)malloc(num_points * sizeof(Vector *));
+        model->point_classes = (int *)malloc(num_points * sizeof(int));
+        model->point_trained = (bool *)malloc(num_points * sizeof(bool));
+        if (!model->point_vectors || !model->point_classes || !model->point_trained) {
+            perror("Failed to allocate memory for points");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < num_points; i++) {
+            if (points[i].position < 0 || points[i].position >= vector_count || points[i].class_idx >= classes) {
+                fprintf(stderr, "%s is truncated or corrupted\n", path);
+                exit(EXIT_FAILURE);
+            }
+            model->point_vectors[i] = model->space->vectors[points[i].position];
+            model->point_classes[i] = points[i].class_idx;
+            model->point_trained[i] = points[i].trained != 0;
+        }
+    }
+    if (classes > 0) {
+        uint64_t *names = (uint64_t *)store_require(mapping, SECTION_MODEL_CLASSES, (uint64_t)classes * sizeof(uint64_t), path);
+        StoredAccumulator *accs = (StoredAccumulator *)store_require(mapping, SECTION_MODEL_ACCUMULATORS, (uint64_t)classes * sizeof(StoredAccumulator), path);
+        int32_t *prototypes = (int32_t *)store_require(mapping, SECTION_MODEL_PROTOTYPES, (uint64_t)classes * model->size * sizeof(int32_t), path);
+        model->classes = (char **)malloc(classes * sizeof(char *));
+        model->class_accumulators = (BundleAccumulator *)malloc(classes * sizeof(BundleAccumulator));
+        model->class_vectors = (Vector **)malloc(classes * sizeof(Vector *));
+        model->class_dirty = (bool *)malloc(classes * sizeof(bool));
+        if (!model->classes || !model->class_accumulators || !model->class_vectors || !model->class_dirty) {
+            perror("Failed to allocate memory for class prototypes");
+            exit(EXIT_FAILURE);
+        }
+        model->classes_count = classes;
+        for (int class_idx = 0; class_idx < classes; class_idx++) {
+            if (names[class_idx] >= strings_length) {
+                fprintf(stderr, "%s is truncated or corrupted\n", path);
+                exit(EXIT_FAILURE);
+            }
+            model->classes[class_idx] = strdup(strings + names[class_idx]);
+            char class_name[50];
+            sprintf(class_name, "class_%d", class_idx);
+            Vector *class_vector = alloc_vector(class_name, model->size, model->vtype, false);
+            memcpy(class_vector->vector, prototypes + (size_t)class_idx * model->size, model->size * sizeof(int));
+            add_tag(class_vector, model->classes[class_idx]);
+            // Restore the counters, then the bookkeeping of everything added since the fit
+            BundleAccumulator *acc = &model->class_accumulators[class_idx];
+            bundle_accumulator_init(acc, model->size, model->vtype);
+            bundle_accumulator_add(acc, class_vector);
+            acc->bound = accs[class_idx].bound;
+            acc->count = (int)accs[class_idx].count;
+            model->class_vectors[class_idx] = class_vector;
+            model->class_dirty[class_idx] = false;
+        }
+    }
+    return model;
+}
+
+/* Save a Graph, including its node and weight memories, to a binary file */
+void save_graph(Graph *graph, const char *path) {
+    StoreWriter writer;
+    store_writer_open(&writer, path, STORE_GRAPH);
+    store_write_space(&writer, graph->space);
+    StoredGraph stored;
+    memset(&stored, 0, sizeof(stored));
+    stored.size = graph->size;
+    stored.directed = graph->directed;
+    stored.weighted = graph->weighted;
+    stored.nodes_counter = graph->nodes_counter;
+    stored.edges_counter = graph->edges_counter;
+    stored.seed = graph->seed;
+    store_section(&writer, SECTION_GRAPH, &stored, sizeof(stored));
+    store_writer_close(&writer);
+}
+
+/* Load a Graph saved with save_graph; its space is loaded in place as with load_space */
+Graph *load_graph(const char *path) {
+    size_t mapping_length;
+    void *mapping = store_map(path, STORE_GRAPH, false, &mapping_length, NULL);
+    StoredGraph *stored = (StoredGraph *)store_require(mapping, SECTION_GRAPH, sizeof(StoredGraph), path);
+    Graph *graph = create_graph(stored->size, stored->directed != 0, stored->weighted != 0, stored->seed);
+    free_space(graph->space);
+    graph->space = store_open_space(mapping, mapping_length, path);
+    graph->nodes_counter = stored->nodes_counter;
+    graph->edges_counter = stored->edges_counter;
+    return graph;
+}
+
+/* Datasets
+ * A dataset file holds the parsed values as the row-major matrix of a Dataset, so a
+ * loaded Dataset uses the rows in place from the mapping: only the row pointers and
+ * the pointers to the strings are built at load time. It records the size and
+ * modification time of the text file it was converted from, so open_dataset_cached
+ * can tell when it is stale. */
+
+/* Write the sections of a Dataset */
+static void store_write_dataset(Dataset *dataset, const char *path, const struct stat *source) {
+    StoreWriter writer;
+    store_writer_open(&writer, path, STORE_DATASET);
+    StoredDataset stored;
+    memset(&stored, 0, sizeof(stored));
+    stored.num_samples = dataset->num_samples;
+    stored.num_features = dataset->num_features;
+    stored.classes_count = dataset->classes_count;
+    if (source) {
+        stored.source_length = (uint64_t)source->st_size;
+        stored.source_mtime = (int64_t)source->st_mtim.tv_sec * 1000000000 + source->st_mtim.tv_nsec;
+    }
+    store_section(&writer, SECTION_DATASET, &stored, sizeof(stored));
+
+    store_begin_section(&writer, SECTION_DATASET_VALUES);
+    for (int i = 0; i < dataset->num_samples; i++) {
+        store_write(&writer, dataset->content[i], dataset->num_features * sizeof(double));
+    }
+    store_begin_section(&writer, SECTION_DATASET_LABELS);
+    for (int i = 0; i < dataset->num_samples; i++) {
+        int32_t label = dataset->labels[i];
+        store_write(&writer, &label, sizeof(label));
+    }
+    store_begin_section(&writer, SECTION_DATASET_SAMPLES);
+    for (int i = 0; i < dataset->num_samples; i++) {
+        uint64_t offset = store_string(&writer, dataset->samples[i]);
+        store_write(&writer, &offset, sizeof(offset));
+    }
+    store_begin_section(&writer, SECTION_DATASET_FEATURES);
+    for (int i = 0; i < dataset->num_features; i++) {
+        uint64_t offset = store_string(&writer, dataset->features[i]);
+        store_write(&writer, &offset, sizeof(offset));
+    }
+    store_begin_section(&writer, SECTION_DATASET_CLASSES);
+    for (int i = 0; i < dataset->classes_count; i++) {
+        uint64_t offset = store_string(&writer, dataset->class_names[i]);
+        store_write(&writer, &offset, sizeof(offset));
+    }
+    store_writer_close(&writer);
+}
+
+/* Save a Dataset loaded with open_dataset to a binary file */
+void save_dataset_cache(Dataset *dataset, const char *path) {
+    store_write_dataset(dataset, path, NULL);
+}
+
+/* Point each entry of a table of string offsets into the string section */
+static char **store_strings_table(const uint64_t *offsets, int count, const char *strings, uint64_t strings_length, const char *path) {
+    char **table = (char **)malloc((count + 1) * sizeof(char *));
+    if (!table) {
+        perror("Failed to allocate memory for dataset");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < count; i++) {
+        if (offsets[i] >= strings_length) {
+            fprintf(stderr, "%s is truncated or corrupted\n", path);
+            exit(EXIT_FAILURE);
+        }
+        table[i] = (char *)strings + offsets[i];
+    }
+    return table;
+}
+
+/* Load a Dataset saved with save_dataset_cache; values and labels are used in place from
+ * the mapped file, which is released by close_dataset. Rows can be modified in memory
+ * without changing the file */
+Dataset *load_dataset_cache(const char *path) {
+    size_t mapping_length;
+    void *mapping = store_map(path, STORE_DATASET, false, &mapping_length, NULL);
+    StoredDataset *stored = (StoredDataset *)store_require(mapping, SECTION_DATASET, sizeof(StoredDataset), path);
+    int num_samples = stored->num_samples;
+    int num_features = stored->num_features;
+    int classes_count = stored->classes_count;
+    if (num_samples < 0 || num_features < 0 || classes_count < 0) {
+        fprintf(stderr, "%s is truncated or corrupted\n", path);
+        exit(EXIT_FAILURE);
+    }
+    double *values = (double *)store_require(mapping, SECTION_DATASET_VALUES, (uint64_t)num_samples * num_features * sizeof(double), path);
+    int32_t *labels = (int32_t *)store_require(mapping, SECTION_DATASET_LABELS, (uint64_t)num_samples * sizeof(int32_t), path);
+    uint64_t *samples = (uint64_t *)store_require(mapping, SECTION_DATASET_SAMPLES, (uint64_t)num_samples * sizeof(uint64_t), path);
+    uint64_t *features = (uint64_t *)store_require(mapping, SECTION_DATASET_FEATURES, (uint64_t)num_features * sizeof(uint64_t), path);
+    uint64_t *classes = (uint64_t *)store_require(mapping, SECTION_DATASET_CLASSES, (uint64_t)classes_count * sizeof(uint64_t), path);
+    char *strings = (char *)store_require(mapping, SECTION_STRINGS, 0, path);
+    uint64_t strings_length = 0;
+    store_find(mapping, SECTION_STRINGS, &strings_length);
+
+    Dataset *dataset = (Dataset *)calloc(1, sizeof(Dataset));
+    if (!dataset) {
+        perror("Failed to allocate memory for dataset");
+        exit(EXIT_FAILURE);
+    }
+    dataset->num_samples = num_samples;
+    dataset->num_features = num_features;
+    dataset->classes_count = classes_count;
+    dataset->mapping = mapping;
+    dataset->mapping_length = mapping_length;
+    dataset->values = values;
+    dataset->labels = (int *)labels;
+    dataset->samples = store_strings_table(samples, num_samples, strings, strings_length, path);
+    dataset->features = store_strings_table(features, num_features, strings, strings_length, path);
+    dataset->class_names = store_strings_table(classes, classes_count, strings, strings_length, path);
+    dataset->content = (double **)malloc((num_samples + 1) * sizeof(double *));
+    dataset->classes = (char **)malloc((num_samples + 1) * sizeof(char *));
+    if (!dataset->content || !dataset->classes) {
+        perror("Failed to allocate memory for dataset");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_samples; i++) {
+        if (labels[i] < -1 || labels[i] >= classes_count) {
+            fprintf(stderr, "%s is truncated or corrupted\n", path);
+            exit(EXIT_FAILURE);
+        }
+        dataset->content[i] = values + (size_t)i * num_features;
+        dataset->classes[i] = labels[i] >= 0 ? dataset->class_names[labels[i]] : NULL;
+    }
+    return dataset;
+}
+
+/* Whether a dataset file was converted from the current version of a text file */
+static bool store_dataset_is_current(const char *cache_path, const struct stat *source) {
+    int fd = open(cache_path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    StoreHeader header;
+    StoredDataset stored;
+    bool current = false;
+    if (pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+        memcmp(header.magic, STORE_MAGIC, sizeof(header.magic)) == 0 && header.byte_order == STORE_BYTE_ORDER &&
+        header.version == STORE_VERSION && header.kind == STORE_DATASET && header.section_count <= STORE_MAX_SECTIONS) {
+        for (uint32_t i = 0; i < header.section_count; i++) {
+            if (header.sections[i].id == SECTION_DATASET && header.sections[i].length >= sizeof(stored) &&
+                pread(fd, &stored, sizeof(stored), (off_t)header.sections[i].offset) == (ssize_t)sizeof(stored)) {
+                current = stored.source_length == (uint64_t)source->st_size &&
+                          stored.source_mtime == (int64_t)source->st_mtim.tv_sec * 1000000000 + source->st_mtim.tv_nsec;
+                break;
+            }
+        }
+    }
+    close(fd);
+    return current;
+}
+
+/* Load a dataset in the text format read by open_dataset through a binary cache file:
+ * the cache is loaded in place when it was converted from the current version of the
+ * text file, otherwise the text file is parsed and the cache is written again */
+Dataset *open_dataset_cached(const char *filepath, const char *sep, const char *cache_path) {
+    struct stat source;
+    if (stat(filepath, &source) != 0) {
+        perror("Failed to stat file");
+        exit(EXIT_FAILURE);
+    }
+    if (store_dataset_is_current(cache_path, &source)) {
+        return load_dataset_cache(cache_path);
+    }
+    // Write a new file and rename it over the old one, which other processes may have mapped
+    Dataset *dataset = open_dataset(filepath, sep);
+    size_t temp_length = strlen(cache_path) + 32;
+    char *temp_path = (char *)malloc(temp_length);
+    if (!temp_path) {
+        perror("Failed to allocate memory for dataset");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(temp_path, temp_length, "%s.%ld.tmp", cache_path, (long)getpid());
+    store_write_dataset(dataset, temp_path, &source);
+    if (rename(temp_path, cache_path) != 0) {
+        perror("Failed to write file");
+        exit(EXIT_FAILURE);
+    }
+    free(temp_path);
+    return dataset;
+}